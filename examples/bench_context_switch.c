@@ -0,0 +1,136 @@
+/*==================[inclusions]=============================================*/
+
+#include <stdio.h>
+
+#include "board.h"
+#include "sapi.h"
+
+#include "br_os_core.h"
+#include "br_os_api.h"
+
+
+/*==================[macros and definitions]=================================*/
+
+// build this example twice, with OS_USE_C_CONTEXT_SWITCH=0 (default) and with -DOS_USE_C_CONTEXT_SWITCH=1
+// (stack pointers swapped by get_next_context() in C) to compare both context switches
+
+#define MILISEC         1000
+
+#define N_SWITCHES      10000
+
+
+/*==================[global data declaration]==============================*/
+
+os_task ping_task, pong_task, report_task;
+
+OS_TASK_STACK(ping_stack, 256);
+OS_TASK_STACK(pong_stack, 256);
+OS_TASK_STACK(report_stack, 1024);   // snprintf
+
+// cycle counter value right before the yield, read by the other task after the switch
+volatile uint32_t switch_start;
+
+volatile uint32_t switch_count;
+volatile uint32_t switch_cycles_total;
+volatile uint32_t switch_cycles_min = UINT32_MAX;
+volatile uint32_t switch_cycles_max;
+
+
+/*==================[internal functions definition]==========================*/
+
+
+static void initHardware(void)  {
+    Board_Init();
+    SystemCoreClockUpdate();
+    SysTick_Config(SystemCoreClock / MILISEC);      // systick 1ms
+
+    // enable the DWT cycle counter
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    // config UART with baud rate 115200
+    uartConfig( UART_USB, 115200 );
+}
+
+
+/*=================================[TASKS]====================================*/
+
+
+/*************************************************************************************************
+     *  @brief Ping y pong tienen la misma prioridad, por lo que cada os_cpu_yield() cambia a la
+     *  otra tarea (Round-robin). Cada una mide los ciclos desde el yield de la otra hasta que
+     *  retoma la ejecucion, es decir scheduler + PendSV_Handler.
+     *
+     * Las mediciones afectadas por el SysTick (que hace su propio cambio de contexto) se
+     * descartan comparando el tiempo del sistema antes y despues del yield.
+***************************************************************************************************/
+void ping_pong_method(void* task_param) {
+    uint32_t cycles;
+    uint32_t tick_before;
+
+    while(1)    {
+        if (switch_count >= N_SWITCHES) {
+            os_delay(MILISEC);
+            continue;
+        }
+
+        tick_before = os_get_current_time();
+        switch_start = DWT->CYCCNT;
+        os_cpu_yield();
+        cycles = DWT->CYCCNT - switch_start;
+
+        if (os_get_current_time() == tick_before)   {
+            switch_count++;
+            switch_cycles_total += cycles;
+            if (cycles < switch_cycles_min) {
+                switch_cycles_min = cycles;
+            }
+            if (cycles > switch_cycles_max) {
+                switch_cycles_max = cycles;
+            }
+        }
+    }
+}
+
+
+void report_method(void* task_param)    {
+    char msg[100];
+
+    while(1)    {
+        os_delay(MILISEC);
+
+        if (switch_count >= N_SWITCHES) {
+            snprintf(msg, sizeof(msg), "%s context switch cycles: avg %lu, min %lu, max %lu\n\r",
+                     OS_USE_C_CONTEXT_SWITCH ? "C" : "assembler",
+                     (unsigned long)(switch_cycles_total / switch_count),
+                     (unsigned long)switch_cycles_min,
+                     (unsigned long)switch_cycles_max);
+            uartWriteString(UART_USB, msg);
+
+            while(1)    {
+                os_delay(MILISEC);
+            }
+        }
+    }
+}
+
+/*============================================================================*/
+
+int main(void)  {
+
+    initHardware();
+
+    os_init_task(report_method, &report_task, NULL, 0, report_stack, sizeof(report_stack));
+    os_init_task(ping_pong_method, &ping_task, NULL, 1, ping_stack, sizeof(ping_stack));
+    os_init_task(ping_pong_method, &pong_task, NULL, 1, pong_stack, sizeof(pong_stack));
+
+    os_init();
+
+    while (1) {
+        __WFI();
+    }
+}
+
+
+/*==================[end of file]============================================*/
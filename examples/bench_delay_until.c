@@ -0,0 +1,175 @@
+/*==================[inclusions]=============================================*/
+
+#include <stdio.h>
+
+#include "board.h"
+#include "sapi.h"
+
+#include "br_os_core.h"
+#include "br_os_api.h"
+
+
+/*==================[macros and definitions]=================================*/
+
+#define MILISEC         1000
+
+#define PERIOD          10      // ticks
+#define WORK_TICKS      3       // execution time of each periodic job
+#define N_PERIODS       1000
+
+#define LOAD_PERIOD     7       // a higher priority task preempts the periodic jobs every LOAD_PERIOD ticks
+#define LOAD_TICKS      1
+
+
+/*==================[global data declaration]==============================*/
+
+os_task until_task, delay_task, load_task, background_task;
+
+OS_TASK_STACK(until_stack, 1024);   // snprintf
+OS_TASK_STACK(delay_stack, 1024);   // snprintf
+OS_TASK_STACK(load_stack, 256);
+OS_TASK_STACK(background_stack, 256);
+
+// cycles of one tick, read after SysTick_Config()
+uint32_t tick_cycles;
+
+
+/*==================[internal functions definition]==========================*/
+
+
+static void initHardware(void)  {
+    Board_Init();
+    SystemCoreClockUpdate();
+    SysTick_Config(SystemCoreClock / MILISEC);      // systick 1ms
+
+    // enable the DWT cycle counter
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    // config UART with baud rate 115200
+    uartConfig( UART_USB, 115200 );
+
+    tick_cycles = SystemCoreClock / MILISEC;
+}
+
+
+// keeps the CPU busy for the given number of ticks (it can be preempted meanwhile)
+static void busy_wait(uint32_t ticks)   {
+    uint32_t start = DWT->CYCCNT;
+    while (DWT->CYCCNT - start < ticks * tick_cycles)   {
+    }
+}
+
+
+/*=================================[TASKS]====================================*/
+
+
+/*************************************************************************************************
+     *  @brief Tarea periodica con os_delay_until(). Mide en ciclos la desviacion de cada
+     *  activacion respecto del instante ideal (inicio + n * PERIOD), e informa el jitter
+     *  (desviacion minima y maxima), la deriva al final y la cantidad de periodos perdidos.
+     *
+***************************************************************************************************/
+void until_method(void* task_param) {
+    char msg[100];
+    uint32_t last_wake, start_cycles;
+    int32_t deviation, min_deviation = INT32_MAX, max_deviation = INT32_MIN;
+    uint32_t overruns = 0;
+
+    last_wake = os_get_current_time();
+    start_cycles = DWT->CYCCNT;
+
+    for (uint32_t n=1; n<=N_PERIODS; n++)   {
+        busy_wait(WORK_TICKS);
+
+        if (os_delay_until(&last_wake, PERIOD) == OS_ERROR_DELAY_OVERRUN)   {
+            overruns++;
+        }
+
+        deviation = (int32_t)(DWT->CYCCNT - start_cycles - n * PERIOD * tick_cycles);
+        if (deviation < min_deviation)  {
+            min_deviation = deviation;
+        }
+        if (deviation > max_deviation)  {
+            max_deviation = deviation;
+        }
+    }
+
+    snprintf(msg, sizeof(msg), "os_delay_until: jitter %ld..%ld cycles, drift %ld cycles, %lu overruns\n\r",
+             (long)min_deviation, (long)max_deviation, (long)deviation, (unsigned long)overruns);
+    uartWriteString(UART_USB, msg);
+
+    while(1)    {
+        os_delay(MILISEC);
+    }
+}
+
+
+/*************************************************************************************************
+     *  @brief La misma tarea periodica con os_delay(PERIOD), como referencia: cada activacion se
+     *  corre por el tiempo de trabajo y las interrupciones de la tarea de carga.
+     *
+***************************************************************************************************/
+void delay_method(void* task_param) {
+    char msg[100];
+    uint32_t start_cycles;
+    int32_t deviation;
+
+    start_cycles = DWT->CYCCNT;
+
+    for (uint32_t n=1; n<=N_PERIODS; n++)   {
+        busy_wait(WORK_TICKS);
+        os_delay(PERIOD);
+    }
+
+    deviation = (int32_t)(DWT->CYCCNT - start_cycles - N_PERIODS * PERIOD * tick_cycles);
+
+    snprintf(msg, sizeof(msg), "os_delay: drift %ld cycles after %u periods\n\r",
+             (long)deviation, N_PERIODS);
+    uartWriteString(UART_USB, msg);
+
+    while(1)    {
+        os_delay(MILISEC);
+    }
+}
+
+
+// higher priority load that preempts the periodic tasks
+void load_method(void* task_param)  {
+    uint32_t last_wake = os_get_current_time();
+
+    while(1)    {
+        busy_wait(LOAD_TICKS);
+        os_delay_until(&last_wake, LOAD_PERIOD);
+    }
+}
+
+
+// lower priority load that never blocks, so the idle task never runs
+void background_method(void* task_param)   {
+    while(1)    {
+        busy_wait(1);
+    }
+}
+
+/*============================================================================*/
+
+int main(void)  {
+
+    initHardware();
+
+    os_init_task(load_method, &load_task, NULL, 0, load_stack, sizeof(load_stack));
+    os_init_task(until_method, &until_task, NULL, 1, until_stack, sizeof(until_stack));
+    os_init_task(delay_method, &delay_task, NULL, 2, delay_stack, sizeof(delay_stack));
+    os_init_task(background_method, &background_task, NULL, 3, background_stack, sizeof(background_stack));
+
+    os_init();
+
+    while (1) {
+        __WFI();
+    }
+}
+
+
+/*==================[end of file]============================================*/
@@ -0,0 +1,182 @@
+/*==================[inclusions]=============================================*/
+
+#include <stdio.h>
+
+#include "board.h"
+#include "sapi.h"
+
+#include "br_os_core.h"
+#include "br_os_api.h"
+
+
+/*==================[macros and definitions]=================================*/
+
+// build this example twice, with OS_USE_BASEPRI=1 (default) and with -DOS_USE_BASEPRI=0 (PRIMASK),
+// both with -DOS_IRQ_TIMER1_EXTERNAL=1 (TIMER1_IRQHandler is defined here)
+
+#define MILISEC         1000
+
+#define BENCH_TIMER     LPC_TIMER1
+#define BENCH_IRQ       TIMER1_IRQn
+#define BENCH_PRIORITY  0           // above OS_MAX_SYSCALL_INTERRUPT_PRIORITY, does not use the OS
+#define BENCH_PERIOD    10007       // timer ticks between interrupts, not a multiple of the SysTick period
+
+#define N_SAMPLES       100000
+#define N_BUCKETS       16
+#define BUCKET_CYCLES   8           // the last bucket also counts every longer latency
+
+
+/*==================[global data declaration]==============================*/
+
+os_task ping_task, pong_task, report_task;
+
+OS_TASK_STACK(ping_stack, 256);
+OS_TASK_STACK(pong_stack, 256);
+OS_TASK_STACK(report_stack, 1024);  // snprintf
+
+os_semaphore ping_semaphore, pong_semaphore;
+
+// latency histogram, written only by the timer interrupt
+uint32_t histogram[N_BUCKETS];
+uint32_t max_latency;
+volatile uint32_t samples;
+
+// CPU cycles per timer tick
+uint32_t timer_cycles;
+
+
+/*==================[internal functions definition]==========================*/
+
+
+static void initHardware(void)  {
+    Board_Init();
+    SystemCoreClockUpdate();
+    SysTick_Config(SystemCoreClock / MILISEC);      // systick 1ms
+
+    // config UART with baud rate 115200
+    uartConfig( UART_USB, 115200 );
+
+    // the timer restarts from 0 on every match, so its count at the start of the
+    // interrupt handler is the time elapsed since the interrupt was requested
+    Chip_TIMER_Init(BENCH_TIMER);
+    Chip_TIMER_PrescaleSet(BENCH_TIMER, 0);
+    Chip_TIMER_SetMatch(BENCH_TIMER, 0, BENCH_PERIOD);
+    Chip_TIMER_ResetOnMatchEnable(BENCH_TIMER, 0);
+    Chip_TIMER_MatchEnableInt(BENCH_TIMER, 0);
+
+    timer_cycles = SystemCoreClock / Chip_Clock_GetRate(CLK_MX_TIMER1);
+
+    NVIC_SetPriority(BENCH_IRQ, BENCH_PRIORITY);
+    NVIC_ClearPendingIRQ(BENCH_IRQ);
+    NVIC_EnableIRQ(BENCH_IRQ);
+}
+
+
+/*=================================[TASKS]====================================*/
+
+
+/*************************************************************************************************
+     *  @brief Las tareas ping y pong se despiertan una a otra continuamente, por lo que el OS
+     *  pasa la mayor parte del tiempo en secciones criticas y cambios de contexto.
+     *
+***************************************************************************************************/
+void ping_method(void* task_param)  {
+    while(1)    {
+        os_semaphore_give(&pong_semaphore);
+        os_semaphore_take(&ping_semaphore, NO_TIMEOUT);
+    }
+}
+
+
+void pong_method(void* task_param)  {
+    while(1)    {
+        os_semaphore_take(&pong_semaphore, NO_TIMEOUT);
+        os_semaphore_give(&ping_semaphore);
+    }
+}
+
+
+/*************************************************************************************************
+     *  @brief Espera N_SAMPLES interrupciones del timer e informa el histograma de la latencia
+     *  (ciclos desde que el timer pide la interrupcion hasta que se ejecuta su handler).
+     *
+***************************************************************************************************/
+void report_method(void* task_param)    {
+    char msg[80];
+
+    Chip_TIMER_Enable(BENCH_TIMER);
+
+    while (samples < N_SAMPLES) {
+        os_delay(100);
+    }
+
+    snprintf(msg, sizeof(msg), "%s critical sections, %u samples, max %lu cycles\n\r",
+             OS_USE_BASEPRI ? "BASEPRI" : "PRIMASK", N_SAMPLES, (unsigned long)max_latency);
+    uartWriteString(UART_USB, msg);
+
+    for (uint32_t i=0; i<N_BUCKETS; i++)    {
+        if (i < N_BUCKETS - 1)  {
+            snprintf(msg, sizeof(msg), "%4lu-%4lu cycles: %lu\n\r", (unsigned long)(i * BUCKET_CYCLES),
+                     (unsigned long)((i + 1) * BUCKET_CYCLES - 1), (unsigned long)histogram[i]);
+        }
+        else    {
+            snprintf(msg, sizeof(msg), "%4lu+     cycles: %lu\n\r", (unsigned long)(i * BUCKET_CYCLES),
+                     (unsigned long)histogram[i]);
+        }
+        uartWriteString(UART_USB, msg);
+    }
+
+    while(1)    {
+        os_delay(MILISEC);
+    }
+}
+
+/*============================================================================*/
+
+int main(void)  {
+
+    initHardware();
+
+    os_init_task(report_method, &report_task, NULL, 0, report_stack, sizeof(report_stack));
+    os_init_task(ping_method, &ping_task, NULL, 1, ping_stack, sizeof(ping_stack));
+    os_init_task(pong_method, &pong_task, NULL, 1, pong_stack, sizeof(pong_stack));
+
+    os_semaphore_init(&ping_semaphore);
+    os_semaphore_init(&pong_semaphore);
+
+    os_init();
+
+    while (1) {
+        __WFI();
+    }
+}
+
+
+/*************************************************************************************************
+     *  @brief Handler del timer, instalado directamente en lugar de os_register_isr() porque su
+     *  prioridad esta por encima de OS_MAX_SYSCALL_INTERRUPT_PRIORITY y no usa el OS.
+     *
+***************************************************************************************************/
+void TIMER1_IRQHandler(void)    {
+    uint32_t latency = Chip_TIMER_ReadCount(BENCH_TIMER) * timer_cycles;
+    uint32_t bucket = latency / BUCKET_CYCLES;
+
+    Chip_TIMER_ClearMatch(BENCH_TIMER, 0);
+
+    if (bucket >= N_BUCKETS)    {
+        bucket = N_BUCKETS - 1;
+    }
+    histogram[bucket]++;
+
+    if (latency > max_latency)  {
+        max_latency = latency;
+    }
+
+    samples++;
+    if (samples == N_SAMPLES)   {
+        NVIC_DisableIRQ(BENCH_IRQ);
+    }
+}
+
+
+/*==================[end of file]============================================*/
@@ -0,0 +1,136 @@
+/*==================[inclusions]=============================================*/
+
+#include <stdio.h>
+
+#include "board.h"
+#include "sapi.h"
+
+#include "br_os_core.h"
+#include "br_os_api.h"
+#include "br_os_isr.h"
+
+
+/*==================[macros and definitions]=================================*/
+
+#define MILISEC         1000
+
+#define N_INTERRUPTS    10000
+#define ADC_RATE        50000       // interrupts per second of the ADC the result is scaled to
+
+// unused interrupts, triggered by software
+#define DYNAMIC_IRQ     DAC_IRQn    // registered with os_register_isr()
+#define STATIC_IRQ      M0APP_IRQn  // bound at build time with OS_STATIC_ISR()
+
+// build with -DOS_IRQ_M0APP_EXTERNAL=1, so br_os_isr.c leaves out its M0APP_IRQHandler
+
+
+/*==================[global data declaration]==============================*/
+
+os_task bench_task;
+
+OS_TASK_STACK(bench_stack, 1024);   // snprintf
+
+volatile uint32_t isr_count;
+
+
+/*==================[internal functions declaration]=========================*/
+void bench_isr(void);
+
+
+/*==================[internal functions definition]==========================*/
+
+
+static void initHardware(void)  {
+    Board_Init();
+    SystemCoreClockUpdate();
+    SysTick_Config(SystemCoreClock / MILISEC);      // systick 1ms
+
+    // enable the DWT cycle counter
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    // config UART with baud rate 115200
+    uartConfig( UART_USB, 115200 );
+}
+
+
+// average cycles from pending the interrupt until the task resumes (entry, dispatch, ISR and exit)
+static uint32_t measure_interrupt(LPC43XX_IRQn_Type irq)    {
+    uint32_t start, total = 0;
+
+    for (uint32_t i=0; i<N_INTERRUPTS; i++) {
+        start = DWT->CYCCNT;
+        NVIC_SetPendingIRQ(irq);
+        __DSB();
+        __ISB();
+        total += DWT->CYCCNT - start;
+    }
+
+    return total / N_INTERRUPTS;
+}
+
+
+/*=================================[TASKS]====================================*/
+
+
+/*************************************************************************************************
+     *  @brief Mide los ciclos de una interrupcion despachada en tiempo de ejecucion (stub de
+     *  br_os_isr.c, os_isr_handler y user_isr_vector) y de una asociada en compilacion con
+     *  OS_STATIC_ISR(), con la misma ISR, e informa los ciclos ahorrados a la tasa del ADC.
+     *
+     * Como la ISR no despierta ninguna tarea, no se incluye el scheduler.
+***************************************************************************************************/
+void bench_method(void* task_param) {
+    char msg[100];
+    uint32_t dynamic_cycles, static_cycles;
+
+    dynamic_cycles = measure_interrupt(DYNAMIC_IRQ);
+    static_cycles = measure_interrupt(STATIC_IRQ);
+
+    snprintf(msg, sizeof(msg), "os_register_isr: %lu cycles, OS_STATIC_ISR: %lu cycles\n\r",
+             (unsigned long)dynamic_cycles, (unsigned long)static_cycles);
+    uartWriteString(UART_USB, msg);
+
+    snprintf(msg, sizeof(msg), "saved: %ld cycles per interrupt, %ld cycles/s at %u Hz\n\r",
+             (long)(dynamic_cycles - static_cycles),
+             (long)(dynamic_cycles - static_cycles) * ADC_RATE, ADC_RATE);
+    uartWriteString(UART_USB, msg);
+
+    while(1)    {
+        os_delay(MILISEC);
+    }
+}
+
+/*============================================================================*/
+
+int main(void)  {
+
+    initHardware();
+
+    os_init_task(bench_method, &bench_task, NULL, 0, bench_stack, sizeof(bench_stack));
+
+    // interrupts that use the OS must not be above OS_MAX_SYSCALL_INTERRUPT_PRIORITY
+    NVIC_SetPriority(DYNAMIC_IRQ, OS_MAX_SYSCALL_INTERRUPT_PRIORITY);
+    NVIC_SetPriority(STATIC_IRQ, OS_MAX_SYSCALL_INTERRUPT_PRIORITY);
+
+    os_register_isr(DYNAMIC_IRQ, bench_isr);
+    os_enable_static_isr(STATIC_IRQ);
+
+    os_init();
+
+    while (1) {
+        __WFI();
+    }
+}
+
+
+void bench_isr(void)    {
+    isr_count++;
+}
+
+
+OS_STATIC_ISR(M0APP_IRQHandler, STATIC_IRQ, bench_isr)
+
+
+/*==================[end of file]============================================*/
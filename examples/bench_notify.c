@@ -0,0 +1,167 @@
+/*==================[inclusions]=============================================*/
+
+#include <stdio.h>
+
+#include "board.h"
+#include "sapi.h"
+
+#include "br_os_core.h"
+#include "br_os_api.h"
+#include "br_os_isr.h"
+
+
+/*==================[macros and definitions]=================================*/
+
+#define MILISEC         1000
+
+#define N_SIGNALS       10000
+#define BENCH_IRQ       DAC_IRQn    // unused interrupt, triggered by software
+
+
+/*==================[global data declaration]==============================*/
+
+os_task waiter_task, trigger_task;
+
+OS_TASK_STACK(waiter_stack, 1024);  // snprintf
+OS_TASK_STACK(trigger_stack, 256);
+
+os_semaphore bench_semaphore;
+
+// true while measuring os_task_notify_from_isr(), false while measuring os_semaphore_give_from_isr()
+volatile bool use_notification;
+
+// cycle counter value right before pending the interrupt
+volatile uint32_t signal_start;
+
+volatile bool bench_done;
+
+
+/*==================[internal functions declaration]=========================*/
+void bench_isr(void);
+
+
+/*==================[internal functions definition]==========================*/
+
+
+static void initHardware(void)  {
+    Board_Init();
+    SystemCoreClockUpdate();
+    SysTick_Config(SystemCoreClock / MILISEC);      // systick 1ms
+
+    // enable the DWT cycle counter
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    // config UART with baud rate 115200
+    uartConfig( UART_USB, 115200 );
+}
+
+
+/*=================================[TASKS]====================================*/
+
+
+/*************************************************************************************************
+     *  @brief Mide los ciclos desde que la tarea de menor prioridad dispara la interrupcion hasta
+     *  que esta tarea retoma la ejecucion, primero avisando con os_semaphore_give_from_isr() y
+     *  luego con os_task_notify_from_isr(). Incluye la entrada a la interrupcion, os_isr_handler,
+     *  el scheduler y PendSV_Handler.
+     *
+***************************************************************************************************/
+void waiter_method(void* task_param)    {
+    char msg[100];
+    uint32_t cycles, total, min, max;
+
+    for (uint8_t mode=0; mode<2; mode++)    {
+        use_notification = (mode == 1);
+        total = 0;
+        min = UINT32_MAX;
+        max = 0;
+
+        for (uint32_t i=0; i<N_SIGNALS; i++)    {
+            if (use_notification)   {
+                os_task_notify_wait(0xFFFFFFFF, NO_TIMEOUT, NULL);
+            }
+            else    {
+                os_semaphore_take(&bench_semaphore, NO_TIMEOUT);
+            }
+            cycles = DWT->CYCCNT - signal_start;
+
+            total += cycles;
+            if (cycles < min)   {
+                min = cycles;
+            }
+            if (cycles > max)   {
+                max = cycles;
+            }
+        }
+
+        snprintf(msg, sizeof(msg), "%s: avg %lu, min %lu, max %lu cycles\n\r",
+                 use_notification ? "os_task_notify_from_isr" : "os_semaphore_give_from_isr",
+                 (unsigned long)(total / N_SIGNALS), (unsigned long)min, (unsigned long)max);
+        uartWriteString(UART_USB, msg);
+    }
+
+    bench_done = true;
+
+    while(1)    {
+        os_delay(MILISEC);
+    }
+}
+
+
+/*************************************************************************************************
+     *  @brief Dispara la interrupcion continuamente. Como tiene menor prioridad, solo se ejecuta
+     *  cuando waiter_task ya esta bloqueada esperando el proximo aviso.
+     *
+***************************************************************************************************/
+void trigger_method(void* task_param)   {
+    while(!bench_done)  {
+        signal_start = DWT->CYCCNT;
+        NVIC_SetPendingIRQ(BENCH_IRQ);
+    }
+
+    while(1)    {
+        os_delay(MILISEC);
+    }
+}
+
+/*============================================================================*/
+
+int main(void)  {
+
+    initHardware();
+
+    os_init_task(waiter_method, &waiter_task, NULL, 0, waiter_stack, sizeof(waiter_stack));
+    os_init_task(trigger_method, &trigger_task, NULL, 1, trigger_stack, sizeof(trigger_stack));
+
+    os_semaphore_init(&bench_semaphore);
+
+    // interrupts that use the OS must not be above OS_MAX_SYSCALL_INTERRUPT_PRIORITY
+    NVIC_SetPriority(BENCH_IRQ, OS_MAX_SYSCALL_INTERRUPT_PRIORITY);
+
+    os_register_isr(BENCH_IRQ, bench_isr);
+
+    os_init();
+
+    while (1) {
+        __WFI();
+    }
+}
+
+
+void bench_isr(void)    {
+    bool higher_priority_task_woken = false;
+
+    if (use_notification)   {
+        os_task_notify_from_isr(&waiter_task, 0, OS_NOTIFY_INCREMENT, &higher_priority_task_woken);
+    }
+    else    {
+        os_semaphore_give_from_isr(&bench_semaphore, &higher_priority_task_woken);
+    }
+
+    os_yield_from_isr(higher_priority_task_woken);
+}
+
+
+/*==================[end of file]============================================*/
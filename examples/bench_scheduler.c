@@ -0,0 +1,221 @@
+/*==================[inclusions]=============================================*/
+
+#include <stdio.h>
+
+#include "board.h"
+#include "sapi.h"
+
+#include "br_os_core.h"
+#include "br_os_api.h"
+
+
+/*==================[macros and definitions]=================================*/
+
+#define MILISEC             1000
+
+#define N_BLOCKED_TASKS     (OS_MAX_TASK - 1)   // every slot except the one used by the benchmark task
+#define N_ITERATIONS        1000
+#define BLOCKED_FOREVER     0xFFFFFFFF
+
+#define LEGACY_N_PRIORITY   (N_BLOCKED_TASKS + 1)
+
+
+/*==================[global data declaration]==============================*/
+
+os_task blocked_task[N_BLOCKED_TASKS];
+os_task bench_task;
+
+OS_TASK_STACK(blocked_stack[N_BLOCKED_TASKS], 128);
+OS_TASK_STACK(bench_stack, 1024);   // snprintf
+
+
+/*==================[internal functions declaration]=========================*/
+
+static uint32_t legacy_linear_scan(os_task** task_list, uint8_t number_of_tasks, uint8_t* tasks_per_priority);
+static os_task* bitmap_select(uint32_t* ready_bitmap, os_task** ready_list);
+
+
+/*==================[internal functions definition]==========================*/
+
+
+static void initHardware(void)  {
+    Board_Init();
+    SystemCoreClockUpdate();
+    SysTick_Config(SystemCoreClock / MILISEC);      // systick 1ms
+
+    // enable the DWT cycle counter
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    // config UART with baud rate 115200
+    uartConfig( UART_USB, 115200 );
+}
+
+
+/*=================================[TASKS]====================================*/
+
+
+/*************************************************************************************************
+     *  @brief Tarea que se bloquea inmediatamente y no vuelve a ejecutarse. Tiene mayor prioridad
+     *  que la tarea de benchmark, por lo que un scheduler lineal la recorre en cada pasada.
+     *
+***************************************************************************************************/
+void blocked_method(void* task_param)   {
+    while(1)    {
+        os_delay(BLOCKED_FOREVER);
+    }
+}
+
+
+/*************************************************************************************************
+     *  @brief Mide los ciclos de la seleccion de tarea (sin el cambio de contexto) del scheduler
+     *  con bitmap y de una copia del scheduler lineal anterior, ambos con 0 a N_BLOCKED_TASKS
+     *  tareas bloqueadas de mayor prioridad. Como referencia mide tambien os_cpu_yield() completo.
+     *
+     * Como la tarea de benchmark es la unica lista, os_cpu_yield() la vuelve a elegir y no pende
+     * PendSV, por lo que ese resultado es solo el scheduler, sin cambio de contexto (medido en
+     * bench_context_switch.c).
+***************************************************************************************************/
+void bench_method(void* task_param) {
+    char msg[100];
+    uint32_t start, linear_cycles, bitmap_cycles;
+    os_task* task_list[N_BLOCKED_TASKS + 1];
+    uint8_t tasks_per_priority[LEGACY_N_PRIORITY];
+    os_task* ready_list[OS_N_PRIORITY];
+    uint32_t ready_bitmap;
+
+    start = DWT->CYCCNT;
+    for (uint32_t i=0; i<N_ITERATIONS; i++) {
+        os_cpu_yield();
+    }
+    bitmap_cycles = (DWT->CYCCNT - start) / N_ITERATIONS;
+
+    snprintf(msg, sizeof(msg), "os_cpu_yield (scheduler only, no context switch), %u blocked tasks: %lu cycles\n\r",
+             N_BLOCKED_TASKS, (unsigned long)bitmap_cycles);
+    uartWriteString(UART_USB, msg);
+
+    for (uint8_t n_blocked=0; n_blocked<=N_BLOCKED_TASKS; n_blocked++)  {
+        // the legacy scheduler walks the blocked tasks (one per priority) before finding this task
+        memset(tasks_per_priority, 0, sizeof(tasks_per_priority));
+        for (uint8_t i=0; i<n_blocked; i++) {
+            task_list[i] = &blocked_task[i];
+            tasks_per_priority[i] = 1;
+        }
+        task_list[n_blocked] = &bench_task;
+        tasks_per_priority[n_blocked] = 1;
+
+        // blocked tasks are not in the ready lists, only this task is, at priority n_blocked
+        memset(ready_list, 0, sizeof(ready_list));
+        ready_list[n_blocked] = &bench_task;
+        ready_bitmap = OS_PRIORITY_BIT(n_blocked);
+
+        os_enter_critical_section();
+
+        start = DWT->CYCCNT;
+        for (uint32_t i=0; i<N_ITERATIONS; i++) {
+            legacy_linear_scan(task_list, n_blocked + 1, tasks_per_priority);
+        }
+        linear_cycles = (DWT->CYCCNT - start) / N_ITERATIONS;
+
+        start = DWT->CYCCNT;
+        for (uint32_t i=0; i<N_ITERATIONS; i++) {
+            bitmap_select(&ready_bitmap, ready_list);
+        }
+        bitmap_cycles = (DWT->CYCCNT - start) / N_ITERATIONS;
+
+        os_exit_critical_section();
+
+        snprintf(msg, sizeof(msg), "%u blocked tasks: linear scan %lu cycles, bitmap %lu cycles\n\r",
+                 n_blocked, (unsigned long)linear_cycles, (unsigned long)bitmap_cycles);
+        uartWriteString(UART_USB, msg);
+    }
+
+    while(1)    {
+        os_delay(BLOCKED_FOREVER);
+    }
+}
+
+/*============================================================================*/
+
+int main(void)  {
+
+    initHardware();
+
+    for (uint8_t i=0; i<N_BLOCKED_TASKS; i++)   {
+        os_init_task(blocked_method, &blocked_task[i], NULL, i, blocked_stack[i], sizeof(blocked_stack[i]));
+    }
+    os_init_task(bench_method, &bench_task, NULL, N_BLOCKED_TASKS, bench_stack, sizeof(bench_stack));
+
+    os_init();
+
+    while (1) {
+        __WFI();
+    }
+}
+
+
+/*************************************************************************************************
+     *  @brief Copia de la seleccion de tarea del scheduler lineal anterior (sin el cambio de
+     *  contexto), que recorre las tareas ordenadas por prioridad hasta encontrar una no bloqueada.
+     *
+     * Devuelve el indice de la tarea elegida, o number_of_tasks si todas estan bloqueadas.
+***************************************************************************************************/
+static __attribute__((noinline)) uint32_t legacy_linear_scan(os_task** task_list, uint8_t number_of_tasks, uint8_t* tasks_per_priority)    {
+    static uint8_t index_per_priority[LEGACY_N_PRIORITY];
+
+    uint8_t index_offset = 0;
+    uint8_t real_index = 0;
+    uint8_t total_iterated_tasks = 0;
+    uint8_t priority_iterated_tasks = 0;
+    uint8_t current_priority = 0;
+
+    while (total_iterated_tasks < number_of_tasks)  {
+
+        priority_iterated_tasks = 0;
+        while (priority_iterated_tasks < tasks_per_priority[current_priority])    {
+            real_index = index_per_priority[current_priority] + index_offset;
+
+            if (task_list[real_index]->state != OS_TASK_BLOCKED)  {
+                index_per_priority[current_priority] = (index_per_priority[current_priority] + 1) % tasks_per_priority[current_priority];
+                return real_index;
+            }
+
+            index_per_priority[current_priority] = (index_per_priority[current_priority] + 1) % tasks_per_priority[current_priority];
+            priority_iterated_tasks++;
+        }
+
+        index_offset = index_offset + tasks_per_priority[current_priority];
+        total_iterated_tasks = total_iterated_tasks + priority_iterated_tasks;
+        current_priority++;
+    }
+
+    return number_of_tasks;
+}
+
+
+/*************************************************************************************************
+     *  @brief Copia de la seleccion de tarea de scheduler() (sin el cambio de contexto), sobre un
+     *  bitmap y listas de tareas listas propias del benchmark.
+     *
+     * Devuelve la tarea elegida, o NULL si no hay tareas listas.
+***************************************************************************************************/
+static __attribute__((noinline)) os_task* bitmap_select(uint32_t* ready_bitmap, os_task** ready_list)  {
+    uint8_t priority;
+    os_task* selected_task;
+
+    if (*ready_bitmap == 0) {
+        return NULL;
+    }
+
+    priority = __CLZ(*ready_bitmap);
+    selected_task = ready_list[priority];
+
+    // advance the head so the next task of the same priority is chosen the next time (Round-robin)
+    ready_list[priority] = selected_task->next;
+
+    return selected_task;
+}
+
+
+/*==================[end of file]============================================*/
@@ -0,0 +1,97 @@
+/*==================[inclusions]=============================================*/
+
+#include <stdio.h>
+
+#include "board.h"
+#include "sapi.h"
+
+#include "br_os_core.h"
+#include "br_os_api.h"
+
+
+/*==================[macros and definitions]=================================*/
+
+// this example must be built with OS_USE_TICKLESS_IDLE=1 (e.g. -DOS_USE_TICKLESS_IDLE=1)
+
+#define MILISEC         1000
+
+#define BLINK_PERIOD    500
+#define REPORT_PERIOD   5000
+
+
+/*==================[global data declaration]==============================*/
+
+os_task blink_task, report_task;
+
+OS_TASK_STACK(blink_stack, 192);
+OS_TASK_STACK(report_stack, 1024);   // snprintf
+
+
+/*==================[internal functions definition]==========================*/
+
+
+static void initHardware(void)  {
+    Board_Init();
+    SystemCoreClockUpdate();
+    SysTick_Config(SystemCoreClock / MILISEC);      // systick 1ms
+
+    // config UART with baud rate 115200
+    uartConfig( UART_USB, 115200 );
+}
+
+
+/*=================================[TASKS]====================================*/
+
+
+void blink_method(void* task_param) {
+    bool led_state = false;
+
+    while(1)    {
+        led_state = !led_state;
+        gpioWrite(LED1, led_state);
+        os_delay(BLINK_PERIOD);
+    }
+}
+
+
+/*************************************************************************************************
+     *  @brief Informa periodicamente cuantos ticks fueron atendidos por SysTick_Handler y cuantos
+     *  fueron salteados por el modo tickless. Sin tickless, la cantidad salteada es siempre 0.
+     *
+***************************************************************************************************/
+void report_method(void* task_param)    {
+    char msg[80];
+    uint32_t system_time, elided_ticks;
+
+    while(1)    {
+        os_delay(REPORT_PERIOD);
+
+        system_time = os_get_current_time();
+        elided_ticks = os_get_elided_ticks();
+
+        snprintf(msg, sizeof(msg), "ticks: %lu, handled: %lu, elided: %lu\n\r",
+                 (unsigned long)system_time,
+                 (unsigned long)(system_time - elided_ticks),
+                 (unsigned long)elided_ticks);
+        uartWriteString(UART_USB, msg);
+    }
+}
+
+/*============================================================================*/
+
+int main(void)  {
+
+    initHardware();
+
+    os_init_task(blink_method, &blink_task, NULL, 0, blink_stack, sizeof(blink_stack));
+    os_init_task(report_method, &report_task, NULL, 1, report_stack, sizeof(report_stack));
+
+    os_init();
+
+    while (1) {
+        __WFI();
+    }
+}
+
+
+/*==================[end of file]============================================*/
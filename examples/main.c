@@ -15,6 +15,8 @@
 #define TEC1_PORT_NUM   0
 #define TEC1_BIT_VAL    4
 
+#define TASK_STACK_SIZE 256
+
 
 /*==================[global data declaration]==============================*/
 
@@ -23,9 +25,20 @@ os_semaphore sem_task_1, sem_task_2, sem_task_3;
 os_queue queue_task_4;
 
 os_task on_led_task, off_led_task, uart_task;
+
+OS_TASK_STACK(stack_task_1, TASK_STACK_SIZE);
+OS_TASK_STACK(stack_task_2, TASK_STACK_SIZE);
+OS_TASK_STACK(stack_task_3, TASK_STACK_SIZE);
+OS_TASK_STACK(stack_task_4, TASK_STACK_SIZE);
+OS_TASK_STACK(stack_on_led, TASK_STACK_SIZE);
+OS_TASK_STACK(stack_off_led, TASK_STACK_SIZE);
+OS_TASK_STACK(stack_uart, TASK_STACK_SIZE);
 os_semaphore sem_tec_falling, sem_tec_rising;
 os_queue uart_queue;
 
+OS_QUEUE_STORAGE(queue_task_4_storage, sizeof(uint32_t), 16);
+OS_QUEUE_STORAGE(uart_queue_storage, sizeof(char), 64);
+
 
 /*==================[internal functions declaration]=========================*/
 void tec1_down_isr(void);
@@ -70,7 +83,7 @@ void task_1(void* task_param)  {
 
     while (1) {
         //os_semaphore_take(&sem_task_1, NO_TIMEOUT);
-        os_queue_receive(&queue_task_4, &data);
+        os_queue_receive(&queue_task_4, &data, NO_TIMEOUT);
         gpioWrite(LED1, true);
         os_delay(data);
         gpioWrite(LED1, false);
@@ -122,7 +135,7 @@ void task_4(void* task_param)  {
     while (1) {
 
         if (!gpioRead(TEC2))    {
-            os_queue_send(&queue_task_4, &num);
+            os_queue_send(&queue_task_4, &num, NO_TIMEOUT);
             // os_semaphore_give(&sem_task_1);
             os_delay(250);
 
@@ -162,7 +175,7 @@ void turn_led(void* task_param) {
 
         char_index = 0;
         while (msg[char_index] != NULL && char_index < 25) {
-            os_queue_send(&uart_queue, (msg + char_index));
+            os_queue_send(&uart_queue, (msg + char_index), NO_TIMEOUT);
             char_index++;
         }
     }
@@ -173,7 +186,7 @@ void send_uart(void* task_param)    {
     char aux;
 
     while(1)    {
-        os_queue_receive(&uart_queue, &aux);
+        os_queue_receive(&uart_queue, &aux, NO_TIMEOUT);
         uartWriteByte(UART_USB, aux);
     }
 }
@@ -184,25 +197,29 @@ int main(void)  {
 
     initHardware();
 
-    os_init_task(task_1, &instance_os_task_1, (void*)1000, 1);
-    os_init_task(task_2, &instance_os_task_2, (void*)500,  1);
-    os_init_task(task_3, &instance_os_task_3, (void*)250,  1);
-    os_init_task(task_4, &instance_os_task_4, NULL,        1);
+    os_init_task(task_1, &instance_os_task_1, (void*)1000, 1, stack_task_1, sizeof(stack_task_1));
+    os_init_task(task_2, &instance_os_task_2, (void*)500,  1, stack_task_2, sizeof(stack_task_2));
+    os_init_task(task_3, &instance_os_task_3, (void*)250,  1, stack_task_3, sizeof(stack_task_3));
+    os_init_task(task_4, &instance_os_task_4, NULL,        1, stack_task_4, sizeof(stack_task_4));
 
     os_semaphore_init(&sem_task_1);
     os_semaphore_init(&sem_task_2);
     os_semaphore_init(&sem_task_3);
 
-    os_queue_init(&queue_task_4, sizeof(uint32_t));
+    os_queue_init(&queue_task_4, queue_task_4_storage, sizeof(uint32_t), 16);
 
-    os_init_task(turn_led, &on_led_task, (void*)true, 0);
-    os_init_task(turn_led, &off_led_task, (void*)false, 0);
-    os_init_task(send_uart, &uart_task, NULL, 3);
+    os_init_task(turn_led, &on_led_task, (void*)true, 0, stack_on_led, sizeof(stack_on_led));
+    os_init_task(turn_led, &off_led_task, (void*)false, 0, stack_off_led, sizeof(stack_off_led));
+    os_init_task(send_uart, &uart_task, NULL, 3, stack_uart, sizeof(stack_uart));
 
-    os_queue_init(&uart_queue, sizeof(char));
+    os_queue_init(&uart_queue, uart_queue_storage, sizeof(char), 64);
     os_semaphore_init(&sem_tec_falling);
     os_semaphore_init(&sem_tec_rising);
 
+    // interrupts that use the OS must not be above OS_MAX_SYSCALL_INTERRUPT_PRIORITY
+    NVIC_SetPriority(PIN_INT0_IRQn, OS_MAX_SYSCALL_INTERRUPT_PRIORITY);
+    NVIC_SetPriority(PIN_INT1_IRQn, OS_MAX_SYSCALL_INTERRUPT_PRIORITY);
+
     os_register_isr(PIN_INT0_IRQn, tec1_down_isr);
     os_register_isr(PIN_INT1_IRQn, tec1_up_isr);
 
@@ -215,14 +232,22 @@ int main(void)  {
 
 
 void tec1_down_isr (void) {
-    os_semaphore_give(&sem_tec_falling);
+    bool higher_priority_task_woken = false;
+
+    os_semaphore_give_from_isr(&sem_tec_falling, &higher_priority_task_woken);
     Chip_PININT_ClearIntStatus( LPC_GPIO_PIN_INT, PININTCH( 0 ) );
+
+    os_yield_from_isr(higher_priority_task_woken);
 }
 
 
 void tec1_up_isr(void)  {
-    os_semaphore_give(&sem_tec_rising);
+    bool higher_priority_task_woken = false;
+
+    os_semaphore_give_from_isr(&sem_tec_rising, &higher_priority_task_woken);
     Chip_PININT_ClearIntStatus( LPC_GPIO_PIN_INT, PININTCH( 1 ) );
+
+    os_yield_from_isr(higher_priority_task_woken);
 }
 
 
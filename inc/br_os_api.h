@@ -10,33 +10,165 @@
 
 #include "br_os_core.h"
 
-#define NO_TIMEOUT  0   // used to indicate that the semaphore does not have a timeout
-
 typedef struct  {
-    os_task*    associated_task;
-    bool        taken;
+    uint32_t        count;
+    uint32_t        max_count;      // 1 for a binary semaphore
+    os_wait_list    waiting_tasks;
 } os_semaphore;
 
 
 typedef struct  {
-    uint8_t     data[MAX_QUEUE_SIZE_BYTES];
-    os_task*    associated_task;
-    uint16_t    element_size;
-    uint16_t    front;
-    uint16_t    back;
-    uint16_t    current_elements;
+    os_task*        owner;
+    uint16_t        recursion_count;    // nested locks by the owner
+    os_wait_list    waiting_tasks;
+} os_mutex;
+
+
+typedef struct  {
+    uint8_t*        data;               // storage supplied by the user
+    uint16_t        element_size;
+    uint16_t        mask;               // length - 1, the length is a power of 2
+    uint16_t        front;
+    uint16_t        back;
+    uint16_t        current_elements;
+    bool            send_loan;          // a slot is reserved with os_queue_reserve()
+    bool            receive_loan;       // the front element is borrowed with os_queue_borrow()
+    os_wait_list    waiting_senders;
+    os_wait_list    waiting_receivers;
 } os_queue;
 
 
+// declares the storage for a queue of length elements (length must be a power of 2)
+#define OS_QUEUE_STORAGE(name, element_size, length)    uint8_t name[(element_size) * (length)] __attribute__((aligned(4)))
+
+
+typedef struct  {
+    uint8_t*        data;               // storage supplied by the user
+    uint16_t        mask;               // size - 1, the size is a power of 2
+    uint16_t        trigger_level;      // bytes needed to wake a blocked reader
+    uint16_t        head;               // next byte to write
+    uint16_t        tail;               // next byte to read
+    uint16_t        used;
+    os_wait_list    waiting_writers;
+    os_wait_list    waiting_readers;
+} os_stream_buffer;
+
+
+// declares the storage for a stream buffer of size bytes (size must be a power of 2)
+#define OS_STREAM_BUFFER_STORAGE(name, size)            uint8_t name[(size)]
+
+
+// lock-free ring for a single producer and a single consumer (a task or an interrupt). Sending and
+// receiving do not mask interrupts, only waking up a consumer blocked in os_spsc_ring_receive_wait() does
+typedef struct  {
+    uint8_t*            data;               // storage supplied by the user
+    uint16_t            element_size;
+    uint16_t            mask;               // length - 1, the length is a power of 2
+    volatile uint32_t   head;               // only written by the producer, runs freely
+    volatile uint32_t   tail;               // only written by the consumer, runs freely
+    volatile bool       consumer_waiting;
+    os_wait_list        waiting_consumer;
+} os_spsc_ring;
+
+
+typedef struct  {
+    void*           free_list;          // each free block keeps the next one in its first word
+    uint8_t*        storage;            // storage supplied by the user
+    uint16_t        block_size;         // rounded up to a multiple of 4
+    uint16_t        block_count;
+    uint16_t        free_blocks;
+    uint16_t        min_free_blocks;    // lowest number of free blocks since the init
+    uint32_t        failed_allocs;      // allocations that returned NULL
+    os_wait_list    waiting_tasks;
+} os_pool;
+
+
+#define OS_POOL_BLOCK_SIZE(block_size)                  (((block_size) + 3) & ~3)
+
+// declares the storage for a pool of block_count blocks of block_size bytes
+#define OS_POOL_STORAGE(name, block_size, block_count)  uint32_t name[(block_count) * OS_POOL_BLOCK_SIZE(block_size) / 4]
+
+
+typedef struct  {
+    uint32_t        bits;
+    os_wait_list    waiting_tasks;
+} os_event_group;
+
+
+// os_event_group_wait() options, by default the wait ends when any bit of the mask is set
+#define OS_EVENT_WAIT_ANY           0x00
+#define OS_EVENT_WAIT_ALL           0x01    // the wait ends when every bit of the mask is set
+#define OS_EVENT_CLEAR_ON_EXIT      0x02    // clear the bits of the mask when the wait ends
+
+
+typedef enum    {
+    OS_NOTIFY_SET_BITS,     // notification value |= value
+    OS_NOTIFY_INCREMENT,    // notification value++
+    OS_NOTIFY_OVERWRITE,    // notification value = value
+} os_notify_action;
+
 os_error os_delay(uint32_t ticks);
+os_error os_delay_until(uint32_t* last_wake_time, uint32_t period);
 
 void os_semaphore_init(os_semaphore* semaphore);
+void os_semaphore_init_counting(os_semaphore* semaphore, uint32_t max_count, uint32_t initial_count);
 bool os_semaphore_take(os_semaphore* semaphore, uint32_t ticks_to_wait);
 void os_semaphore_give(os_semaphore* semaphore);
+void os_semaphore_give_from_isr(os_semaphore* semaphore, bool* higher_priority_task_woken);
+
+void os_mutex_init(os_mutex* mutex);
+os_error os_mutex_lock(os_mutex* mutex, uint32_t ticks_to_wait);
+os_error os_mutex_unlock(os_mutex* mutex);
+
+bool os_queue_init(os_queue* queue, void* storage, uint16_t element_size, uint16_t length);
+os_error os_queue_send(os_queue* queue, const void* data, uint32_t ticks_to_wait);
+os_error os_queue_receive(os_queue* queue, void* data, uint32_t ticks_to_wait);
+os_error os_queue_send_from_isr(os_queue* queue, const void* data, bool* higher_priority_task_woken);
+os_error os_queue_receive_from_isr(os_queue* queue, void* data, bool* higher_priority_task_woken);
+uint16_t os_queue_send_batch(os_queue* queue, const void* data, uint16_t count, uint32_t ticks_to_wait);
+uint16_t os_queue_receive_batch(os_queue* queue, void* data, uint16_t max_count, uint32_t ticks_to_wait);
+void* os_queue_reserve(os_queue* queue, uint32_t ticks_to_wait);
+void os_queue_commit(os_queue* queue);
+void* os_queue_borrow(os_queue* queue, uint32_t ticks_to_wait);
+void os_queue_release(os_queue* queue);
+
+bool os_stream_buffer_init(os_stream_buffer* stream, void* storage, uint16_t size, uint16_t trigger_level);
+uint16_t os_stream_buffer_write(os_stream_buffer* stream, const void* data, uint16_t length, uint32_t ticks_to_wait);
+uint16_t os_stream_buffer_write_from_isr(os_stream_buffer* stream, const void* data, uint16_t length, bool* higher_priority_task_woken);
+uint16_t os_stream_buffer_read(os_stream_buffer* stream, void* data, uint16_t max_length, uint32_t ticks_to_wait);
+void os_stream_buffer_flush(os_stream_buffer* stream);
+
+bool os_spsc_ring_init(os_spsc_ring* ring, void* storage, uint16_t element_size, uint16_t length);
+bool os_spsc_ring_send(os_spsc_ring* ring, const void* data);
+bool os_spsc_ring_send_from_isr(os_spsc_ring* ring, const void* data, bool* higher_priority_task_woken);
+bool os_spsc_ring_receive(os_spsc_ring* ring, void* data);
+os_error os_spsc_ring_receive_wait(os_spsc_ring* ring, void* data, uint32_t ticks_to_wait);
+
+bool os_pool_init(os_pool* pool, void* storage, uint16_t block_size, uint16_t block_count);
+void* os_pool_alloc(os_pool* pool, uint32_t ticks_to_wait);
+void* os_pool_alloc_from_isr(os_pool* pool);
+os_error os_pool_free(os_pool* pool, void* block);
+os_error os_pool_free_from_isr(os_pool* pool, void* block, bool* higher_priority_task_woken);
+uint16_t os_pool_get_free_blocks(os_pool* pool);
+uint16_t os_pool_get_min_free_blocks(os_pool* pool);
+uint32_t os_pool_get_failed_allocs(os_pool* pool);
+
+void os_event_group_init(os_event_group* group);
+uint32_t os_event_group_set(os_event_group* group, uint32_t bits);
+uint32_t os_event_group_set_from_isr(os_event_group* group, uint32_t bits, bool* higher_priority_task_woken);
+uint32_t os_event_group_clear(os_event_group* group, uint32_t bits);
+uint32_t os_event_group_get(os_event_group* group);
+os_error os_event_group_wait(os_event_group* group, uint32_t mask, uint8_t options, uint32_t ticks_to_wait, uint32_t* bits);
+
+void os_task_notify(os_task* task, uint32_t value, os_notify_action action);
+void os_task_notify_from_isr(os_task* task, uint32_t value, os_notify_action action, bool* higher_priority_task_woken);
+os_error os_task_notify_wait(uint32_t clear_on_exit, uint32_t ticks_to_wait, uint32_t* value);
 
-bool os_queue_init(os_queue* queue, uint16_t element_size);
-bool os_queue_send(os_queue* queue, void* data);
-bool os_queue_receive(os_queue* queue, void* data);
+bool os_timer_init(os_timer* timer, timer_callback callback, void* param, uint32_t period, bool auto_reload);
+void os_timer_start(os_timer* timer);
+void os_timer_stop(os_timer* timer);
+void os_timer_reset(os_timer* timer);
+bool os_timer_is_active(os_timer* timer);
 
 
 #endif  // __BR_OS_API_H__
@@ -0,0 +1,31 @@
+/*
+ * br_os_config.h
+ *
+ *  Created on: 2020
+ *      Author: mbrignone
+ */
+
+#ifndef __BR_OS_CONFIG_H__
+#define __BR_OS_CONFIG_H__
+
+// configuration shared by br_os_core.h and PendSV_Handler.S, so it must only contain macros.
+// Values defined on the command line must be passed to both the C and the assembler flags
+
+// NVIC priority bits of the target (LPC4337), checked against __NVIC_PRIO_BITS in br_os_core.c
+#define OS_NVIC_PRIO_BITS           3
+
+#ifndef OS_USE_BASEPRI
+#define OS_USE_BASEPRI              1   // 1 to mask with BASEPRI in critical sections, 0 to mask every interrupt with PRIMASK
+#endif
+#ifndef OS_MAX_SYSCALL_INTERRUPT_PRIORITY
+#define OS_MAX_SYSCALL_INTERRUPT_PRIORITY   2   // highest NVIC priority (lowest value) of an interrupt that uses the OS
+#endif
+// interrupts with a priority value lower than this one are never masked by the OS
+#define OS_BASEPRI_VALUE            (OS_MAX_SYSCALL_INTERRUPT_PRIORITY << (8 - OS_NVIC_PRIO_BITS))
+
+#ifndef OS_USE_C_CONTEXT_SWITCH
+#define OS_USE_C_CONTEXT_SWITCH     0   // 1 to swap the stack pointers in get_next_context() (C) instead of in PendSV_Handler, to compare both
+#endif
+
+
+#endif  // __BR_OS_CONFIG_H__
@@ -11,9 +11,19 @@
 #include <stdint.h>
 #include <string.h>
 #include "board.h"
+#include "br_os_config.h"
 
 
-#define STACK_SIZE 256  // predefined task stack size (in bytes)
+#define OS_MIN_STACK_SIZE       (FULL_STACKING_SIZE*4 + 4)  // initial context rounded up to 8 bytes (in bytes)
+#define OS_IDLE_STACK_SIZE      160     // idle task stack size (in bytes), interrupts use the MSP and not this stack
+#define OS_STACK_FILL_PATTERN   0xA5A5A5A5  // stacks are painted with this value to measure their usage
+
+#ifndef OS_CHECK_STACK_OVERFLOW
+#define OS_CHECK_STACK_OVERFLOW 1       // 1 to check the lowest stack word of a task when it is switched out
+#endif
+
+// declares a task stack of size bytes (multiple of 8) with the 8 byte alignment required by AAPCS
+#define OS_TASK_STACK(name, size)   uint32_t name[(size)/4] __attribute__((aligned(8)))
 
 //----------------------------------------------------------------------------------
 
@@ -40,7 +50,7 @@
 
 // initial values for stack frame registers
 #define INIT_XPSR   1 << 24             // xPSR.T = 1
-#define EXEC_RETURN	0xFFFFFFF9          // return to thread mode with MSP, FPU unused
+#define EXEC_RETURN	0xFFFFFFFD          // return to thread mode with PSP, FPU unused
 
 //----------------------------------------------------------------------------------
 
@@ -50,11 +60,32 @@
 #define OS_MAX_TASK                 8
 
 #define OS_MAX_PRIORITY             0   // maximum priority for a task
-#define OS_MIN_PRIORITY             3   // minimum priority for a task
+#define OS_MIN_PRIORITY             31  // minimum priority for a task (one bit per priority in the ready bitmap)
 #define OS_N_PRIORITY               (OS_MIN_PRIORITY - OS_MAX_PRIORITY + 1)
 #define OS_IDLE_PRIORITY            (OS_MIN_PRIORITY + 1)     // idle task priority lower than the lowest priority
 
-#define MAX_QUEUE_SIZE_BYTES        64
+// bit of the ready bitmap for a given priority, placed so that __CLZ(bitmap) is the highest ready priority
+#define OS_PRIORITY_BIT(priority)   (1UL << (31 - (priority)))
+
+#define NO_TIMEOUT                  0   // used to indicate that a blocking call does not have a timeout
+
+#ifndef OS_USE_TICKLESS_IDLE
+#define OS_USE_TICKLESS_IDLE        0   // 1 to stop SysTick while only the idle task is ready
+#endif
+#define OS_TICKLESS_MIN_IDLE_TICKS  2   // SysTick is only stopped if the idle period is at least this long
+
+#ifndef OS_USE_TIMERS
+#define OS_USE_TIMERS               1   // 1 to run the software timer service task
+#endif
+#ifndef OS_TIMER_TASK_PRIORITY
+#define OS_TIMER_TASK_PRIORITY      OS_MAX_PRIORITY     // priority of the task that runs the timer callbacks
+#endif
+#define OS_TIMER_STACK_SIZE         256     // timer task stack size (in bytes), the callbacks run on it
+
+// OS_USE_BASEPRI and OS_MAX_SYSCALL_INTERRUPT_PRIORITY are in br_os_config.h (shared with PendSV_Handler.S)
+#ifndef OS_CHECK_ISR_PRIORITY
+#define OS_CHECK_ISR_PRIORITY       0   // debug: 1 to trap OS calls from interrupts above OS_MAX_SYSCALL_INTERRUPT_PRIORITY (reads the NVIC in every critical section)
+#endif
 
 //----------------------------------------------------------------------------------
 
@@ -68,6 +99,13 @@ typedef enum    {
 } os_task_state;
 
 typedef enum    {
+    OS_NOTIFICATION_NONE,       // nothing received since the last os_task_notify_wait()
+    OS_NOTIFICATION_PENDING,    // notified, not received yet
+    OS_NOTIFICATION_WAITING,    // blocked in os_task_notify_wait()
+} os_notification_state;
+
+typedef enum    {
+    OS_STATE_STOPPED,       // os_init() not called yet, SysTick does not schedule
     OS_STATE_NORMAL,
     OS_STATE_RESET,
     OS_STATE_ISR,
@@ -79,42 +117,107 @@ typedef enum    {
     OS_ERROR_MAX_PRIORITY   = 0x02,
     OS_ERROR_TIMEOUT        = 0x03,
     OS_ERROR_DELAY_FROM_ISR = 0x04,
+    OS_ERROR_STACK_SIZE     = 0x05,
+    OS_ERROR_STACK_OVERFLOW = 0x06,
+    OS_ERROR_MUTEX_FROM_ISR = 0x07,
+    OS_ERROR_MUTEX_OWNER    = 0x08,
+    OS_ERROR_POOL_BLOCK     = 0x09,
+    OS_ERROR_DELAY_OVERRUN  = 0x0A,
+    OS_ERROR_QUEUE_FULL     = 0x0B,
+    OS_ERROR_QUEUE_EMPTY    = 0x0C,
+    OS_ERROR_ISR_PRIORITY   = 0x0D,
     OS_ERROR_GENERIC        = 0xFF,
 } os_error;
 
+// tasks blocked on a kernel object, ordered by priority (FIFO for the same priority)
 typedef struct  {
-    uint32_t        stack[STACK_SIZE/4];
+    struct os_task* head;
+} os_wait_list;
+
+// stack_pointer must be the first field, PendSV_Handler accesses it at offset 0
+typedef struct os_task   {
     uint32_t        stack_pointer;
+    uint32_t*       stack;          // caller supplied stack (lowest address)
+    uint32_t        stack_size;     // stack size in bytes
     task_function   entry_point;
     uint8_t         id;
     os_task_state   state;
-    uint8_t         priority;
-    uint32_t        remaining_blocked_ticks;
+    uint8_t         priority;       // effective priority, may be raised by priority inheritance
+    uint8_t         base_priority;  // priority given at os_init_task()
+    uint8_t         mutexes_held;
+    uint32_t        remaining_blocked_ticks;    // ticks after the previous task of the delay list expires
+    struct os_task* next;       // next task in the ready list (circular) or in wait_list
+    struct os_task* prev;       // previous task in the ready list (circular) or in wait_list
+    struct os_task* delay_next; // next task in the delay list (sorted by expiration)
+    struct os_task* delay_prev; // previous task in the delay list (sorted by expiration)
+    os_wait_list*   wait_list;  // kernel object wait list the task is blocked on, if any
+    bool            timed_out;  // the last block ended because its timeout expired
+    uint32_t        wait_bits;      // event group bits waited for, then the bits that woke the task
+    uint8_t         wait_options;   // event group wait options (OS_EVENT_WAIT_ALL, OS_EVENT_CLEAR_ON_EXIT)
+    uint32_t        notification_value;     // updated by os_task_notify()
+    os_notification_state notification_state;
 } os_task;
 
+struct os_timer;
+
+// function pointer with the prototype of a timer callback
+typedef void (* timer_callback) (struct os_timer *);
+
+typedef struct os_timer {
+    timer_callback      callback;
+    void*               param;              // free for the user (e.g. to share a callback)
+    uint32_t            period;             // in ticks
+    uint32_t            remaining_ticks;    // ticks after the previous timer of the timer list expires
+    bool                auto_reload;
+    bool                active;             // in the timer list
+    bool                callback_queued;    // in the callback queue of the timer task
+    bool                callback_pending;   // the callback must run (cleared if stopped meanwhile)
+    struct os_timer*    next;               // next timer in the timer list (sorted by expiration)
+    struct os_timer*    prev;               // previous timer in the timer list
+    struct os_timer*    callback_next;      // next timer in the callback queue
+} os_timer;
+
+// current_task and next_task must be the first fields, PendSV_Handler accesses them at offsets 0 and 4
 typedef struct  {
+    os_task*    current_task;
+    os_task*    next_task;
     os_task*    task_list[OS_MAX_TASK];
     uint8_t     number_of_tasks;
-    uint8_t     tasks_per_priority[OS_N_PRIORITY];
+    os_task*    ready_list[OS_N_PRIORITY];  // READY/RUNNING tasks of each priority, head is the next to run
+    uint32_t    ready_bitmap;               // OS_PRIORITY_BIT set for every non-empty ready list
+    os_task*    delay_list;                 // blocked tasks with a timeout, as a delta list
+    os_timer*   timer_list;                 // active software timers, as a delta list
+    os_timer*   callback_head;              // expired timers whose callback the timer task must run
+    os_timer*   callback_tail;
     os_error    last_error;
     os_state    state;
-    os_task*    current_task;
-    os_task*    next_task;
     int16_t     current_critical_sections;
     bool        schedule_from_isr;
+    uint8_t     isr_nesting;                // interrupts entered with os_isr_enter() and not exited yet
     uint32_t    system_time;
+    uint32_t    tick_cycles;                // SysTick cycles of one tick, read at os_init()
+    uint32_t    elided_ticks;               // ticks skipped by the tickless idle mode
+    uint32_t    context_switches;           // scheduling decisions that pended PendSV
+    uint32_t    avoided_context_switches;   // scheduling decisions that kept the current task
 } os_control;
 
 
 //----------------------------------------------------------------------------------
 
-os_error os_init_task(task_function entry_point, os_task* task, void* task_param, uint8_t priority);
+os_error os_init_task(task_function entry_point, os_task* task, void* task_param, uint8_t priority,
+                      uint32_t* stack, uint32_t stack_size);
+void os_init_kernel_task(task_function entry_point, os_task* task, uint8_t id, uint8_t priority,
+                         uint32_t* stack, uint32_t stack_size);
 void os_init(void);
 
 void os_set_error(os_error error, void* caller);
 os_error os_get_last_error(void);
 os_task* os_get_current_task(void);
 uint32_t os_get_current_time(void);
+uint32_t os_get_elided_ticks(void);
+uint32_t os_get_context_switches(void);
+uint32_t os_get_avoided_context_switches(void);
+uint32_t os_get_stack_high_water_mark(os_task* task);
 
 os_state os_get_global_state(void);
 void os_set_global_state(os_state state);
@@ -122,9 +225,49 @@ void os_set_global_state(os_state state);
 void os_set_scheduler_from_isr(bool value);
 bool os_get_scheduler_from_isr(void);
 
+void os_yield_from_isr(bool higher_priority_task_woken);
+
+void os_block_task(os_task* task, uint32_t ticks);
+void os_unblock_task(os_task* task);
+void os_set_inherited_priority(os_task* task, uint8_t priority);
+
+void os_arm_timer(os_timer* timer, uint32_t ticks);
+void os_disarm_timer(os_timer* timer);
+os_task* os_get_timer_task(void);
+
+void os_wait_list_init(os_wait_list* wait_list);
+os_error os_wait_on_list(os_wait_list* wait_list, uint32_t ticks);
+os_error os_wait_on_list_until(os_wait_list* wait_list, uint32_t start_time, uint32_t ticks);
+os_task* os_wake_from_list(os_wait_list* wait_list);
+
+void os_tickless_idle(void);
+
 void os_cpu_yield(void);
 void os_enter_critical_section(void);
 void os_exit_critical_section(void);
 
+//----------------------------------------------------------------------------------
+
+// defined in br_os_core.c, exported for the interrupt prologue and epilogue below
+extern os_control os_controller;
+
+// start of an interrupt that uses the OS, before any OS call. Inline so that the handlers
+// generated with OS_STATIC_ISR() do not pay a call. Nested interrupts end before the one
+// they interrupted, so the nesting counter does not need a critical section
+static inline void os_isr_enter(void)   {
+    os_controller.isr_nesting++;
+}
+
+// end of an interrupt that uses the OS. When the outermost interrupt exits, the scheduler
+// runs once if any of the nested interrupts woke up a task
+static inline void os_isr_exit(void)    {
+    os_controller.isr_nesting--;
+
+    if (os_controller.isr_nesting == 0 && os_controller.schedule_from_isr)  {
+        os_controller.schedule_from_isr = false;
+        os_cpu_yield();
+    }
+}
+
 
 #endif  // __BR_OS_CORE_H__
@@ -16,8 +16,44 @@
 
 #define N_IRQ   53
 
+#ifndef OS_DEFERRED_ISR_TASK_PRIORITY
+#define OS_DEFERRED_ISR_TASK_PRIORITY   OS_MAX_PRIORITY     // priority of the task that runs the bottom halves
+#endif
+#ifndef OS_DEFERRED_ISR_STACK_SIZE
+#define OS_DEFERRED_ISR_STACK_SIZE      256     // deferred interrupt task stack size (in bytes), the bottom halves run on it
+#endif
+#ifndef OS_DEFERRED_ISR_QUEUE_LENGTH
+#define OS_DEFERRED_ISR_QUEUE_LENGTH    16      // pending bottom halves (power of 2)
+#endif
+
+// first part of a deferred interrupt, runs inside the interrupt: acknowledges the peripheral
+// and returns the payload passed to the bottom half
+typedef uint32_t (* isr_top_half) (void);
+
+// second part of a deferred interrupt, runs in the deferred interrupt task with full OS access
+typedef void (* isr_bottom_half) (LPC43XX_IRQn_Type irq, uint32_t payload);
+
+// binds user_isr to an interrupt at build time: defines its vector table handler (for example
+// GPIO0_IRQHandler for PIN_INT0_IRQn) with the OS prologue and epilogue inlined around a direct
+// call. The handler of br_os_isr.c must be left out building with OS_IRQ_<name>_EXTERNAL=1 (for
+// example OS_IRQ_GPIO0_EXTERNAL). The interrupt is then enabled with os_enable_static_isr() and
+// must not be registered with os_register_isr()
+#define OS_STATIC_ISR(irq_handler, irq, user_isr)   \
+    void irq_handler(void)  {                       \
+        os_isr_enter();                             \
+        user_isr();                                 \
+        NVIC_ClearPendingIRQ(irq);                  \
+        os_isr_exit();                              \
+    }
+
 bool os_register_isr(LPC43XX_IRQn_Type irq, void* user_isr);
+bool os_enable_static_isr(LPC43XX_IRQn_Type irq);
+bool os_register_deferred_isr(LPC43XX_IRQn_Type irq, isr_top_half top_half, isr_bottom_half bottom_half);
 bool os_remove_isr(LPC43XX_IRQn_Type irq);
 
+os_task* os_get_deferred_isr_task(void);
+uint32_t os_get_deferred_isr_overruns(void);
+uint32_t os_get_spurious_irqs(void);
+
 
 #endif  // __BR_OS_ISR_H__
@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+"""
+Worst-case stack depth per task entry function, from GCC stack usage output.
+
+Build the project with "make STACK_USAGE=1", which adds these flags to the
+compiler flags:
+
+    -fstack-usage -fcallgraph-info=su
+
+GCC then writes a .su file (frame size of every function) and a .ci file
+(call graph in VCG format) next to every object file. "make stack-usage" then
+reports the tasks of main.c, or run it directly:
+
+    python3 scripts/stack_usage.py <build dir> tec1_method tec2_method turn_led send_uart
+
+For each entry function the report shows the deepest call chain found in the
+call graph plus the context that the kernel keeps on the task stack (exception
+frame and the registers saved by PendSV_Handler). Results marked as incomplete
+include calls that cannot be followed (indirect calls, recursion or functions
+compiled without the flags, e.g. library code), so add margin for them.
+Compare the result with os_get_stack_high_water_mark() measured at run time.
+
+Without .ci files only the frame of each entry function itself is reported.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+# hardware exception frame (8 words) + r4-r11 and EXEC_RETURN saved by PendSV_Handler (9 words)
+KERNEL_CONTEXT_BYTES = (8 + 9) * 4
+# extended frame with s0-s15, FPSCR and reserved word (18 words) + s16-s31 saved by PendSV_Handler
+FPU_CONTEXT_BYTES = (18 + 16) * 4
+
+NODE_RE = re.compile(r'node:\s*\{\s*title:\s*"([^"]+)"\s*label:\s*"([^"]*)"')
+EDGE_RE = re.compile(r'edge:\s*\{\s*sourcename:\s*"([^"]+)"\s*targetname:\s*"([^"]+)"')
+BYTES_RE = re.compile(r'(\d+) bytes \((static|dynamic|dynamic,bounded)\)')
+SU_RE = re.compile(r'^(.*):(\d+):(\d+):(\S+)\s+(\d+)\s+(\S+)$')
+
+
+def find_files(build_dir, extension):
+    for root, _, files in os.walk(build_dir):
+        for name in files:
+            if name.endswith(extension):
+                yield os.path.join(root, name)
+
+
+def parse_su(build_dir):
+    """Returns {function: (bytes, qualifier)} from the .su files."""
+    frames = {}
+    for path in find_files(build_dir, '.su'):
+        with open(path) as su_file:
+            for line in su_file:
+                match = SU_RE.match(line.strip())
+                if match:
+                    frames[match.group(4)] = (int(match.group(5)), match.group(6))
+    return frames
+
+
+def parse_ci(build_dir):
+    """Returns ({function: (bytes, qualifier)}, {function: set(callees)}) from the .ci files."""
+    frames = {}
+    calls = {}
+    for path in find_files(build_dir, '.ci'):
+        with open(path) as ci_file:
+            text = ci_file.read()
+        for title, label in NODE_RE.findall(text):
+            match = BYTES_RE.search(label)
+            if match:
+                frames[title] = (int(match.group(1)), match.group(2))
+        for source, target in EDGE_RE.findall(text):
+            calls.setdefault(source, set()).add(target)
+    return frames, calls
+
+
+def worst_case(function, frames, calls, stack=None, memo=None):
+    """Returns (bytes, chain, incomplete) for the deepest call chain starting at function."""
+    stack = stack if stack is not None else []
+    memo = memo if memo is not None else {}
+
+    if function in memo:
+        return memo[function]
+    if function in stack:
+        return 0, [function + ' (recursion)'], True
+    if function not in frames:
+        return 0, [function + ' (unknown)'], True
+
+    own_bytes, qualifier = frames[function]
+    incomplete = qualifier == 'dynamic'
+    deepest = (0, [], False)
+
+    stack.append(function)
+    for callee in sorted(calls.get(function, ())):
+        result = worst_case(callee, frames, calls, stack, memo)
+        incomplete = incomplete or result[2]
+        if result[0] > deepest[0]:
+            deepest = result
+    stack.pop()
+
+    result = (own_bytes + deepest[0], [function] + deepest[1], incomplete)
+    memo[function] = result
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('build_dir', help='directory with the .su/.ci files')
+    parser.add_argument('entry_points', nargs='+', help='task entry functions')
+    parser.add_argument('--fpu', action='store_true', help='tasks use the FPU (extended frames)')
+    args = parser.parse_args()
+
+    frames, calls = parse_ci(args.build_dir)
+    if not frames:
+        frames = parse_su(args.build_dir)
+        calls = {}
+        print('no .ci files found, reporting only the frame of each entry function')
+    if not frames:
+        sys.exit('no stack usage information found in ' + args.build_dir)
+
+    context_bytes = KERNEL_CONTEXT_BYTES + (FPU_CONTEXT_BYTES if args.fpu else 0)
+
+    for entry_point in args.entry_points:
+        depth, chain, incomplete = worst_case(entry_point, frames, calls)
+        total = depth + context_bytes
+        # stacks are declared in multiples of 8 bytes
+        suggested = (total + 7) & ~7
+        print('%-24s %5d bytes (%d calls + %d context)%s -> OS_TASK_STACK size >= %d' % (
+            entry_point, total, depth, context_bytes, ' incomplete' if incomplete else '', suggested))
+        print('    ' + ' -> '.join(chain))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,66 @@
+/*
+ * board.h
+ *
+ * Reemplazo de board.h (sAPI/LPCOpen) para compilar el OS en la PC: solo declara los registros
+ * del Cortex-M4 y las funciones CMSIS que usa el OS. Las implementa sim/src/sim_port.c.
+ */
+
+#ifndef __SIM_BOARD_H__
+#define __SIM_BOARD_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define __NVIC_PRIO_BITS    3
+
+typedef enum    {
+    PendSV_IRQn     = -2,
+    SysTick_IRQn    = -1,
+} IRQn_Type;
+
+typedef struct  {
+    volatile uint32_t ICSR;
+} SCB_Type;
+
+typedef struct  {
+    volatile uint32_t CTRL;
+    volatile uint32_t LOAD;
+    volatile uint32_t VAL;
+} SysTick_Type;
+
+extern SCB_Type* SCB;
+extern uint32_t SystemCoreClock;
+
+// every access to SysTick goes through sim_systick() (sim_port.c), which applies the side effects
+// of the previous writes and lets the modelled counter run between accesses
+SysTick_Type* sim_systick(void);
+#define SysTick     (sim_systick())
+
+#define SCB_ICSR_PENDSVSET_Msk      (1UL << 28)
+#define SCB_ICSR_PENDSVCLR_Msk      (1UL << 27)
+#define SCB_ICSR_PENDSTSET_Msk      (1UL << 26)
+
+#define SysTick_CTRL_ENABLE_Msk     (1UL << 0)
+#define SysTick_CTRL_TICKINT_Msk    (1UL << 1)
+#define SysTick_CTRL_CLKSOURCE_Msk  (1UL << 2)
+#define SysTick_CTRL_COUNTFLAG_Msk  (1UL << 16)
+#define SysTick_LOAD_RELOAD_Msk     0xFFFFFFUL
+
+uint32_t __CLZ(uint32_t value);
+uint32_t __get_IPSR(void);
+void __set_BASEPRI(uint32_t value);
+void __disable_irq(void);
+void __enable_irq(void);
+void __DSB(void);
+void __DMB(void);
+void __ISB(void);
+void __WFI(void);
+
+void NVIC_SetPriority(IRQn_Type irq, uint32_t priority);
+uint32_t NVIC_GetPriority(IRQn_Type irq);
+
+void SysTick_Handler(void);
+
+
+#endif  // __SIM_BOARD_H__
@@ -0,0 +1,25 @@
+/*
+ * sim_port.h
+ *
+ * Simulacion del OS en la PC (ver sim/run.sh).
+ */
+
+#ifndef __SIM_PORT_H__
+#define __SIM_PORT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// modelled SysTick (sim_port.c)
+extern uint64_t sim_cycles;
+extern uint64_t sim_systick_expired_at;
+extern void (*sim_wfi_hook)(void);
+
+void sim_systick_run(uint64_t cycles);
+uint32_t sim_systick_cycles_to_expire(void);
+void sim_systick_expire_on_access(uint32_t accesses);
+
+bool sim_pendsv(void);
+
+
+#endif  // __SIM_PORT_H__
@@ -0,0 +1,33 @@
+#!/bin/sh
+# Compila y ejecuta en la PC las simulaciones del OS (sim/src/sim_*.c), con el board.h de sim/inc
+# en lugar del de la placa. Cada simulacion termina con "ok" o con un assert fallido.
+#
+#     sh sim/run.sh
+
+cd "$(dirname "$0")/.." || exit 1
+
+CFLAGS="-std=gnu99 -g -Wall -Wno-unused-parameter -Wno-pointer-to-int-cast -Wno-int-to-pointer-cast"
+BUILD_DIR=${BUILD_DIR:-/tmp/br_os_sim}
+
+mkdir -p "$BUILD_DIR"
+status=0
+
+for sim in sim/src/sim_*.c; do
+    name=$(basename "$sim" .c)
+    [ "$name" = sim_port ] && continue
+
+    case "$name" in
+        sim_tickless|sim_systick)   flags="-DOS_USE_TICKLESS_IDLE=1 -DOS_USE_TIMERS=0" ;;
+        *)                          flags="" ;;
+    esac
+
+    echo "== $name"
+    if gcc $CFLAGS $flags -I sim/inc -I inc "$sim" sim/src/sim_port.c src/br_os_core.c src/br_os_api.c \
+           -o "$BUILD_DIR/$name" && "$BUILD_DIR/$name"; then
+        :
+    else
+        status=1
+    fi
+done
+
+exit $status
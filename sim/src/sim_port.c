@@ -0,0 +1,167 @@
+/*
+ * sim_port.c
+ *
+ * Registros e intrinsecos del Cortex-M4 para ejecutar el OS en la PC. No hay interrupciones
+ * ni cambios de contexto reales: la simulacion llama a SysTick_Handler() y a sim_pendsv().
+ *
+ * El SysTick es un modelo del contador: solo corre cuando la simulacion lo indica
+ * (sim_systick_run(), el hook de __WFI() o sim_systick_expire_on_access()), el resto del
+ * codigo se ejecuta en tiempo cero.
+ */
+
+#include "board.h"
+#include "br_os_core.h"
+#include "sim_port.h"
+
+
+static SCB_Type scb;
+static SysTick_Type systick;
+static SysTick_Type systick_last;   // registers after the previous access, to detect the writes
+
+SCB_Type* SCB = &scb;
+uint32_t SystemCoreClock = 204000000;
+
+uint64_t sim_cycles;                // simulated time, in core clock cycles
+uint64_t sim_systick_expired_at;    // sim_cycles when the counter last reached 0
+void (*sim_wfi_hook)(void);
+
+static uint32_t cycles_per_access;
+
+static uint32_t nvic_priority[2];
+
+
+uint32_t __CLZ(uint32_t value)      { return value == 0 ? 32 : __builtin_clz(value); }
+uint32_t __get_IPSR(void)           { return 0; }
+void __set_BASEPRI(uint32_t value)  { }
+void __disable_irq(void)            { }
+void __enable_irq(void)             { }
+void __DSB(void)                    { }
+void __DMB(void)                    { }
+void __ISB(void)                    { }
+void __WFI(void)                    { if (sim_wfi_hook != NULL) sim_wfi_hook(); }
+
+void NVIC_SetPriority(IRQn_Type irq, uint32_t priority)   { nvic_priority[irq + 2] = priority; }
+uint32_t NVIC_GetPriority(IRQn_Type irq)                  { return nvic_priority[irq + 2]; }
+
+
+/*************************************************************************************************
+     *  @brief Hace lo mismo que PendSV_Handler si el scheduler lo dejo pendiente: la proxima
+     *  tarea pasa a ser la actual (el contexto no se guarda porque las tareas no se ejecutan).
+     *
+***************************************************************************************************/
+bool sim_pendsv(void)  {
+
+    if ((SCB->ICSR & SCB_ICSR_PENDSVSET_Msk) == 0)  {
+        return false;
+    }
+
+    SCB->ICSR &= ~SCB_ICSR_PENDSVSET_Msk;
+    os_controller.current_task = os_controller.next_task;
+    return true;
+}
+
+
+/*************************************************************************************************
+     *  @brief Avanza el contador del SysTick (si esta habilitado) y el tiempo simulado. Como el
+     *  hardware, al llegar a 0 activa COUNTFLAG y deja pendiente la interrupcion, y en el
+     *  siguiente ciclo recarga LOAD.
+     *
+***************************************************************************************************/
+static void systick_count(uint64_t cycles)  {
+    uint32_t step;
+
+    while (cycles > 0 && (systick.CTRL & SysTick_CTRL_ENABLE_Msk))  {
+        if (systick.VAL == 0)   {
+            systick.VAL = systick.LOAD;
+            step = 1;
+        }
+        else    {
+            step = (cycles < systick.VAL) ? cycles : systick.VAL;
+            systick.VAL -= step;
+
+            if (systick.VAL == 0)   {
+                systick.CTRL |= SysTick_CTRL_COUNTFLAG_Msk;
+                SCB->ICSR |= SCB_ICSR_PENDSTSET_Msk;
+                sim_systick_expired_at = sim_cycles + step;
+            }
+        }
+
+        sim_cycles += step;
+        cycles -= step;
+    }
+
+    sim_cycles += cycles;
+    systick_last = systick;
+}
+
+
+/*************************************************************************************************
+     *  @brief Aplica los efectos de las escrituras a los registros desde el acceso anterior:
+     *  COUNTFLAG no se puede escribir, escribir VAL lo pone en 0 y borra COUNTFLAG, y al
+     *  habilitar el contador con VAL en 0 el primer ciclo carga LOAD.
+     *
+     * Leer CTRL no borra COUNTFLAG: el OS solo lo lee una vez cada vez que duerme.
+***************************************************************************************************/
+static void systick_apply_writes(void)  {
+
+    systick.CTRL = (systick.CTRL & ~SysTick_CTRL_COUNTFLAG_Msk) | (systick_last.CTRL & SysTick_CTRL_COUNTFLAG_Msk);
+
+    if (systick.VAL != systick_last.VAL)    {
+        systick.VAL = 0;
+        systick.CTRL &= ~SysTick_CTRL_COUNTFLAG_Msk;
+    }
+
+    if ((systick.CTRL & SysTick_CTRL_ENABLE_Msk) && !(systick_last.CTRL & SysTick_CTRL_ENABLE_Msk) &&
+        systick.VAL == 0)  {
+        systick_count(1);
+    }
+
+    systick_last = systick;
+}
+
+
+/*************************************************************************************************
+     *  @brief Deja correr el contador del SysTick cycles ciclos.
+     *
+***************************************************************************************************/
+void sim_systick_run(uint64_t cycles) {
+    systick_apply_writes();
+    systick_count(cycles);
+}
+
+
+/*************************************************************************************************
+     *  @brief Ciclos que faltan para que el contador llegue a 0.
+     *
+***************************************************************************************************/
+uint32_t sim_systick_cycles_to_expire(void) {
+    systick_apply_writes();
+    return (systick.VAL == 0) ? systick.LOAD + 1 : systick.VAL;
+}
+
+
+/*************************************************************************************************
+     *  @brief Durante los proximos accesses accesos al SysTick habilitado, el contador corre un
+     *  ciclo antes de cada uno, para que llegue a 0 entre dos instrucciones del OS.
+     *
+***************************************************************************************************/
+void sim_systick_expire_on_access(uint32_t accesses)    {
+    cycles_per_access = accesses;
+}
+
+
+/*************************************************************************************************
+     *  @brief Acceso a los registros del SysTick (la macro SysTick de board.h).
+     *
+***************************************************************************************************/
+SysTick_Type* sim_systick(void) {
+
+    systick_apply_writes();
+
+    if (cycles_per_access > 0 && (systick.CTRL & SysTick_CTRL_ENABLE_Msk))  {
+        cycles_per_access--;
+        systick_count(1);
+    }
+
+    return &systick;
+}
@@ -0,0 +1,215 @@
+/*
+ * sim_systick.c
+ *
+ * Simulacion del modo tickless en la PC con la os_suppress_ticks_and_sleep() de br_os_core.c,
+ * sobre el modelo del SysTick de sim_port.c. Verifica que cada tick atendido por SysTick_Handler
+ * siga alineado al periodo del tick y que el tiempo del sistema coincida con el tiempo simulado,
+ * tambien cuando el contador llega a 0 justo antes de detenerlo (al dormir y al despertar).
+ *
+ * Se compila con OS_USE_TICKLESS_IDLE=1 (ver sim/run.sh).
+ */
+
+#include <stdio.h>
+#include <assert.h>
+
+#include "br_os_core.h"
+#include "br_os_api.h"
+#include "sim_port.h"
+
+
+#define MILISEC             1000
+#define SIM_TICKS           10000   // simulated time
+
+#define N_TASKS             3
+#define WAKE_LATENCY        20      // cycles from the expiration of the counter until SysTick_Handler runs
+#define ENTRY_RACE_EVERY    5       // every ENTRY_RACE_EVERY idle entries the tick expires while stopping SysTick
+
+
+os_task task[N_TASKS];
+OS_TASK_STACK(task_stack[N_TASKS], 256);
+
+// periods longer than what SysTick can sleep at once (24 bit reload), so that limit is also exercised
+static const uint32_t task_period[N_TASKS] = {100, 150, 400};
+
+static uint32_t expected_wake[N_TASKS];
+static uint32_t task_wakeups[N_TASKS];
+
+static uint32_t tick_cycles;
+
+// what the simulated hardware did
+static uint32_t sleeps;
+static uint32_t early_wakes;
+static uint32_t wake_races;
+static uint32_t entry_races;
+static uint32_t systick_calls;
+
+
+/*************************************************************************************************
+     *  @brief Hook de __WFI(): deja correr el SysTick hasta que una interrupcion despierta a la
+     *  CPU. Mientras el SysTick esta dormido para varios ticks, la CPU despierta alternadamente
+     *  por otra interrupcion (a mitad de camino), por el SysTick con la latencia normal, o un
+     *  ciclo antes de que el contador llegue a 0, que entonces llega a 0 mientras se lo detiene.
+     *
+***************************************************************************************************/
+static void sleep_until_interrupt(void) {
+    uint32_t cycles_to_expire = sim_systick_cycles_to_expire();
+
+    if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+        return;
+    }
+
+    // SysTick running with a single tick period, only it can wake the CPU up
+    if (SysTick->LOAD == tick_cycles - 1)   {
+        sim_systick_run(cycles_to_expire + WAKE_LATENCY);
+        return;
+    }
+
+    sleeps++;
+
+    switch (sleeps % 4) {
+    case 0:
+        early_wakes++;
+        sim_systick_run(cycles_to_expire / 2);
+        break;
+    case 1:
+        // the counter reaches 0 on the first SysTick access after waking up
+        wake_races++;
+        sim_systick_run(cycles_to_expire - 1);
+        sim_systick_expire_on_access(1);
+        break;
+    default:
+        sim_systick_run(cycles_to_expire + WAKE_LATENCY);
+        break;
+    }
+}
+
+
+/*************************************************************************************************
+     *  @brief Atiende la interrupcion pendiente del SysTick y verifica que haya vencido en el
+     *  limite de un tick y que el tiempo del sistema sea el tiempo simulado.
+     *
+***************************************************************************************************/
+static void handle_tick(void)   {
+    SCB->ICSR &= ~SCB_ICSR_PENDSTSET_Msk;
+
+    assert(sim_systick_expired_at % tick_cycles == 0);
+
+    SysTick_Handler();
+    systick_calls++;
+
+    assert(os_get_current_time() == sim_systick_expired_at / tick_cycles);
+}
+
+
+// index of a task in task[], or N_TASKS for the idle task
+static uint32_t task_index(os_task* t)  {
+    uint32_t i = 0;
+
+    while (i < N_TASKS && t != &task[i])    {
+        i++;
+    }
+
+    return i;
+}
+
+
+/*************************************************************************************************
+     *  @brief Ejecuta una activacion de la tarea actual: verifica que haya despertado en el tick
+     *  esperado y vuelve a demorarse un periodo.
+     *
+***************************************************************************************************/
+static void run_task(uint32_t i)    {
+    uint32_t now = os_get_current_time();
+
+    // the first activation happens when the OS starts
+    if (expected_wake[i] != 0)  {
+        assert(now == expected_wake[i]);
+        task_wakeups[i]++;
+    }
+
+    expected_wake[i] = now + task_period[i];
+    os_delay(task_period[i]);
+}
+
+
+static void task_method(void* task_param)   {
+}
+
+
+int main(void)  {
+    uint32_t current_task, expected_wakeups, cycles_to_expire;
+    uint32_t idle_entries = 0;
+
+    // SysTick_Config()
+    tick_cycles = SystemCoreClock / MILISEC;
+    SysTick->LOAD = tick_cycles - 1;
+    SysTick->VAL = 0;
+    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk | SysTick_CTRL_ENABLE_Msk;
+
+    sim_wfi_hook = sleep_until_interrupt;
+
+    for (uint32_t i=0; i<N_TASKS; i++)  {
+        os_init_task(task_method, &task[i], NULL, i, task_stack[i], sizeof(task_stack[i]));
+    }
+
+    os_init();
+
+    // the first tick starts the OS
+    sim_systick_run(sim_systick_cycles_to_expire() + WAKE_LATENCY);
+    handle_tick();
+    sim_pendsv();
+
+    while (1)   {
+        current_task = task_index(os_get_current_task());
+
+        if (current_task == N_TASKS)    {
+            // the tasks woken up by the last tick have already run
+            if (os_get_current_time() >= SIM_TICKS) {
+                break;
+            }
+
+            // the counter reaches 0 while os_suppress_ticks_and_sleep() stops it
+            idle_entries++;
+            cycles_to_expire = sim_systick_cycles_to_expire();
+            if (idle_entries % ENTRY_RACE_EVERY == 0 && cycles_to_expire > 1)    {
+                entry_races++;
+                sim_systick_run(cycles_to_expire - 1);
+                sim_systick_expire_on_access(1);
+            }
+
+            os_tickless_idle();
+
+            // otherwise another interrupt woke the CPU up and the idle task sleeps again
+            if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+                handle_tick();
+            }
+        }
+        else    {
+            run_task(current_task);
+        }
+
+        sim_pendsv();
+    }
+
+    printf("%lu ticks: %lu handled by SysTick, %lu elided in %lu sleeps "
+           "(%lu woken early, %lu expired on wakeup, %lu expired on entry)\n",
+           (unsigned long)os_get_current_time(), (unsigned long)systick_calls,
+           (unsigned long)os_get_elided_ticks(), (unsigned long)sleeps, (unsigned long)early_wakes,
+           (unsigned long)wake_races, (unsigned long)entry_races);
+
+    assert(os_get_current_time() == systick_calls + os_get_elided_ticks());
+    assert(os_get_elided_ticks() > systick_calls);
+    assert(early_wakes > 0 && wake_races > 0 && entry_races > 0);
+
+    for (uint32_t i=0; i<N_TASKS; i++)  {
+        // started at tick 1
+        expected_wakeups = (os_get_current_time() - 1) / task_period[i];
+
+        printf("task %lu: %lu wakeups, %lu expected\n", (unsigned long)i,
+               (unsigned long)task_wakeups[i], (unsigned long)expected_wakeups);
+        assert(task_wakeups[i] == expected_wakeups);
+    }
+
+    puts("ok");
+    return 0;
+}
@@ -0,0 +1,195 @@
+/*
+ * sim_tickless.c
+ *
+ * Simulacion del modo tickless en la PC. Reemplaza os_suppress_ticks_and_sleep() (weak en
+ * br_os_core.c) por una version que "duerme" avanzando un reloj simulado, y verifica que
+ * luego de la compensacion de ticks el tiempo del sistema, la lista de demoras y los
+ * despertares de las tareas sean los mismos que sin modo tickless.
+ *
+ * Se compila con OS_USE_TICKLESS_IDLE=1 (ver sim/run.sh).
+ */
+
+#include <stdio.h>
+#include <assert.h>
+
+#include "br_os_core.h"
+#include "br_os_api.h"
+#include "sim_port.h"
+
+
+#define MILISEC             1000
+#define SIM_TICKS           10000   // simulated time
+
+#define N_TASKS             3
+#define EARLY_WAKE_EVERY    4       // every EARLY_WAKE_EVERY sleeps an interrupt wakes the CPU halfway
+
+
+os_task task[N_TASKS];
+OS_TASK_STACK(task_stack[N_TASKS], 256);
+
+// periods longer than what SysTick can sleep at once (24 bit reload), so that limit is also exercised
+static const uint32_t task_period[N_TASKS] = {100, 150, 400};
+
+static uint32_t expected_wake[N_TASKS];
+static uint32_t task_wakeups[N_TASKS];
+
+// what the simulated hardware did
+static uint32_t sleeps;
+static uint32_t early_wakes;
+static uint32_t elided_total;
+static uint32_t systick_calls;
+static bool sleep_called;
+static bool tick_pending;
+
+
+/*************************************************************************************************
+     *  @brief Reemplazo de os_suppress_ticks_and_sleep(): duerme idle_ticks ticks (limitado a lo
+     *  que permite el SysTick), o menos si "llega una interrupcion". Igual que la version del
+     *  hardware, el ultimo tick de un periodo completo queda pendiente para SysTick_Handler.
+     *
+***************************************************************************************************/
+uint32_t os_suppress_ticks_and_sleep(uint32_t idle_ticks)   {
+    uint32_t max_ticks = SysTick_LOAD_RELOAD_Msk / (SysTick->LOAD + 1);
+    uint32_t elided_ticks;
+
+    sleep_called = true;
+    sleeps++;
+
+    if (idle_ticks > max_ticks) {
+        idle_ticks = max_ticks;
+    }
+
+    if (sleeps % EARLY_WAKE_EVERY == 0) {
+        // woken up in the middle of a tick, that tick is still running
+        early_wakes++;
+        elided_ticks = idle_ticks / 2;
+    }
+    else    {
+        tick_pending = true;
+        elided_ticks = idle_ticks - 1;
+    }
+
+    elided_total += elided_ticks;
+    return elided_ticks;
+}
+
+
+// index of a task in task[], or N_TASKS for the idle task
+static uint32_t task_index(os_task* t)  {
+    uint32_t i = 0;
+
+    while (i < N_TASKS && t != &task[i])    {
+        i++;
+    }
+
+    return i;
+}
+
+
+/*************************************************************************************************
+     *  @brief Ejecuta una activacion de la tarea actual: verifica que haya despertado en el tick
+     *  esperado y vuelve a demorarse un periodo.
+     *
+***************************************************************************************************/
+static void run_task(uint32_t i)    {
+    uint32_t now = os_get_current_time();
+
+    // the first activation happens when the OS starts
+    if (expected_wake[i] != 0)  {
+        assert(now == expected_wake[i]);
+        task_wakeups[i]++;
+    }
+
+    expected_wake[i] = now + task_period[i];
+    os_delay(task_period[i]);
+}
+
+
+/*************************************************************************************************
+     *  @brief Verifica que la primera tarea de la lista de demoras despierte en el tick esperado
+     *  luego de compensar los ticks salteados.
+     *
+***************************************************************************************************/
+static void check_delay_list(void)  {
+    os_task* head = os_controller.delay_list;
+
+    if (head != NULL)   {
+        assert(head->remaining_blocked_ticks > 0);
+        assert(os_get_current_time() + head->remaining_blocked_ticks == expected_wake[task_index(head)]);
+    }
+}
+
+
+static void task_method(void* task_param)   {
+}
+
+
+int main(void)  {
+    uint32_t current_task, expected_wakeups;
+
+    SysTick->LOAD = SystemCoreClock / MILISEC - 1;
+
+    for (uint32_t i=0; i<N_TASKS; i++)  {
+        os_init_task(task_method, &task[i], NULL, i, task_stack[i], sizeof(task_stack[i]));
+    }
+
+    os_init();
+
+    // the first tick starts the OS
+    SysTick_Handler();
+    systick_calls++;
+    sim_pendsv();
+
+    while (1)   {
+        current_task = task_index(os_get_current_task());
+
+        if (current_task == N_TASKS)    {
+            // the tasks woken up by the last tick have already run
+            if (os_get_current_time() >= SIM_TICKS) {
+                break;
+            }
+
+            // only the idle task is ready
+            sleep_called = false;
+            tick_pending = false;
+
+            os_tickless_idle();
+
+            if (sleep_called)   {
+                check_delay_list();
+            }
+
+            // the tick that ended the sleep, or the next one if SysTick was not stopped
+            if (!sleep_called || tick_pending)  {
+                SysTick_Handler();
+                systick_calls++;
+            }
+        }
+        else    {
+            run_task(current_task);
+        }
+
+        sim_pendsv();
+    }
+
+    printf("%lu ticks: %lu handled by SysTick, %lu elided in %lu sleeps (%lu woken early)\n",
+           (unsigned long)os_get_current_time(), (unsigned long)systick_calls,
+           (unsigned long)os_get_elided_ticks(), (unsigned long)sleeps, (unsigned long)early_wakes);
+
+    assert(os_get_elided_ticks() == elided_total);
+    assert(os_get_current_time() == systick_calls + elided_total);
+    assert(elided_total > systick_calls);
+    assert(early_wakes > 0);
+
+    for (uint32_t i=0; i<N_TASKS; i++)  {
+        // started at tick 1
+        expected_wakeups = (os_get_current_time() - 1) / task_period[i];
+
+        printf("task %lu: %lu wakeups, %lu expected\n", (unsigned long)i,
+               (unsigned long)task_wakeups[i], (unsigned long)expected_wakeups);
+        assert(task_wakeups[i] == expected_wakeups);
+    }
+
+    puts("ok");
+    return 0;
+}
@@ -9,6 +9,23 @@
 #include "br_os_api.h"
 
 
+static void os_schedule_woken_task(os_task* woken_task);
+static void os_report_woken_task(os_task* woken_task, bool* higher_priority_task_woken);
+static os_task* os_semaphore_release(os_semaphore* semaphore);
+static os_task* os_queue_push(os_queue* queue, const void* data);
+static os_task* os_queue_pop(os_queue* queue, void* data);
+static uint16_t os_stream_buffer_push(os_stream_buffer* stream, const uint8_t* source, uint16_t length, os_task** woken_task);
+static bool os_spsc_ring_push(os_spsc_ring* ring, const void* data, os_task** woken_task);
+static bool os_pool_can_free_block(os_pool* pool, void* block);
+static os_task* os_pool_put_block(os_pool* pool, void* block);
+static os_task* os_event_group_update(os_event_group* group, uint32_t bits);
+static os_task* os_task_notify_update(os_task* task, uint32_t value, os_notify_action action);
+static void os_ring_write(uint8_t* ring, uint16_t mask, uint16_t index, uint16_t element_size, const uint8_t* source, uint16_t count);
+static void os_ring_read(const uint8_t* ring, uint16_t mask, uint16_t index, uint16_t element_size, uint8_t* destination, uint16_t count);
+static void* os_pool_take_block(os_pool* pool);
+static bool os_event_condition_met(uint32_t bits, uint32_t mask, uint8_t options);
+
+
 /*************************************************************************************************
      *  @brief Delay en unidades de tick del OS.
      *
@@ -25,13 +42,8 @@ os_error os_delay(uint32_t ticks)   {
 
     if (ticks > 0)  {
 
-        os_enter_critical_section();
-
         current_task = os_get_current_task();
-        current_task->state = OS_TASK_BLOCKED;
-        current_task->remaining_blocked_ticks = ticks;
-
-        os_exit_critical_section();
+        os_block_task(current_task, ticks);
 
         // force scheduling to go out of the delayed task
         os_cpu_yield();
@@ -42,13 +54,67 @@ os_error os_delay(uint32_t ticks)   {
 
 
 
+/*************************************************************************************************
+     *  @brief Delay hasta el instante *last_wake_time + period (en ticks del OS), para ejecutar
+     *  una tarea periodicamente sin que el periodo se corra por el tiempo de ejecucion o por las
+     *  tareas de mayor prioridad. *last_wake_time se actualiza con el nuevo instante, y se debe
+     *  inicializar con os_get_current_time() antes de la primera llamada.
+     *
+     * Si el instante ya paso, no se bloquea y retorna OS_ERROR_DELAY_OVERRUN. *last_wake_time
+     * igualmente avanza un periodo, por lo que las siguientes llamadas recuperan la fase.
+***************************************************************************************************/
+os_error os_delay_until(uint32_t* last_wake_time, uint32_t period)   {
+
+    uint32_t elapsed_ticks;
+
+    // cannot call a delay from an ISR
+    if (os_get_global_state() == OS_STATE_ISR)  {
+        os_set_error(OS_ERROR_DELAY_FROM_ISR, os_delay_until);
+        return OS_ERROR_DELAY_FROM_ISR;
+    }
+
+    os_enter_critical_section();
+
+    // unsigned arithmetic keeps working when system_time overflows
+    elapsed_ticks = os_get_current_time() - *last_wake_time;
+    *last_wake_time += period;
+
+    if (elapsed_ticks > period) {
+        os_exit_critical_section();
+        os_set_error(OS_ERROR_DELAY_OVERRUN, os_delay_until);
+        return OS_ERROR_DELAY_OVERRUN;
+    }
+
+    if (elapsed_ticks < period) {
+        os_block_task(os_get_current_task(), period - elapsed_ticks);
+    }
+
+    os_exit_critical_section();
+
+    // force scheduling to go out of the delayed task
+    os_cpu_yield();
+
+    return OS_OK;
+}
+
+
 /*************************************************************************************************
      *  @brief Inicializa un semaforo binario.
      *
 ***************************************************************************************************/
 void os_semaphore_init(os_semaphore* semaphore) {
-    semaphore->taken = true;            // initially taken
-    semaphore->associated_task = NULL;  // no task initially associated
+    os_semaphore_init_counting(semaphore, 1, 0);    // initially taken
+}
+
+
+/*************************************************************************************************
+     *  @brief Inicializa un semaforo contador, con max_count como valor maximo de la cuenta.
+     *
+***************************************************************************************************/
+void os_semaphore_init_counting(os_semaphore* semaphore, uint32_t max_count, uint32_t initial_count) {
+    semaphore->max_count    = max_count;
+    semaphore->count        = (initial_count > max_count) ? max_count : initial_count;
+    os_wait_list_init(&semaphore->waiting_tasks);
 }
 
 
@@ -57,192 +123,1732 @@ void os_semaphore_init(os_semaphore* semaphore) {
      *  o hasta que transcurra el timeout (ticks_to_wait).
      *  ticks_to_wait = 0 significa que no hay timeout y se queda esperando por siempre
      *  hasta que el semaforo este libre.
+     *  Desde una interrupcion no se bloquea, solo se toma si esta libre.
      *
      * Retorna true si se pudo tomar el semaforo, false si expiro el timeout.
 ***************************************************************************************************/
 bool os_semaphore_take(os_semaphore* semaphore, uint32_t ticks_to_wait)   {
 
-    os_task* current_task = os_get_current_task();
+    bool taken = true;
 
-    if (current_task->state == OS_TASK_RUNNING) {
-        if (ticks_to_wait != NO_TIMEOUT)    {
-            current_task->remaining_blocked_ticks = ticks_to_wait;
-        }
+    os_enter_critical_section();
+
+    if (semaphore->count > 0)   {
+        semaphore->count--;
+    }
+    else if (os_get_global_state() == OS_STATE_ISR) {
+        // cannot block inside an ISR
+        taken = false;
+    }
+    else    {
+        // os_semaphore_give() hands the semaphore over to the highest priority waiting task,
+        // so the task only wakes up once it owns it (or when the timeout expires)
+        taken = (os_wait_on_list(&semaphore->waiting_tasks, ticks_to_wait) == OS_OK);
+    }
 
-        while (1)    {
+    os_exit_critical_section();
 
-            if (semaphore->taken == true)   {
-                semaphore->associated_task = current_task;
+    return taken;
+}
 
-                // the timeout expired, could not take the semaphore but must return anyway
-                if (current_task->remaining_blocked_ticks == 0 && ticks_to_wait != NO_TIMEOUT) {
-                    return false;   // this also breaks out of the while(1)
-                }
-                else    {
-                    current_task->state = OS_TASK_BLOCKED;
-                    os_cpu_yield();
-                }
 
-            }
-            else    {
-                semaphore->taken = true;
-                current_task->remaining_blocked_ticks = 0;
-                return true;    // this also breaks out of the while (1)
-            }
 
-        } // while (1)
+/*************************************************************************************************
+     *  @brief Se libera un semaforo. Si hay tareas esperando, se despierta solo la de mayor
+     *  prioridad; si no, se incrementa la cuenta (hasta max_count).
+     *
+***************************************************************************************************/
+void os_semaphore_give(os_semaphore* semaphore) {
+
+    os_task* woken_task;
+
+    os_enter_critical_section();
+    woken_task = os_semaphore_release(semaphore);
+    os_exit_critical_section();
+
+    os_schedule_woken_task(woken_task);
+}
+
+
+/*************************************************************************************************
+     *  @brief Version de os_semaphore_give() para interrupciones. No hace el scheduling: si se
+     *  desperto una tarea de mayor prioridad que la interrumpida pone en true
+     *  *higher_priority_task_woken (nunca lo pone en false, por lo que se puede compartir entre
+     *  varias llamadas), y la interrupcion lo pasa luego a os_yield_from_isr().
+     *
+***************************************************************************************************/
+void os_semaphore_give_from_isr(os_semaphore* semaphore, bool* higher_priority_task_woken)  {
+
+    os_task* woken_task;
+
+    os_enter_critical_section();
+    woken_task = os_semaphore_release(semaphore);
+    os_exit_critical_section();
+
+    os_report_woken_task(woken_task, higher_priority_task_woken);
+}
+
+
+/*************************************************************************************************
+     *  @brief Inicializa un mutex (inicialmente libre).
+     *
+***************************************************************************************************/
+void os_mutex_init(os_mutex* mutex) {
+    mutex->owner            = NULL;
+    mutex->recursion_count  = 0;
+    os_wait_list_init(&mutex->waiting_tasks);
+}
+
+
+/*************************************************************************************************
+     *  @brief Se toma un mutex. Si lo tiene otra tarea, esta hereda la prioridad de la tarea
+     *  actual si es mayor, y la tarea actual queda bloqueada hasta que el mutex sea liberado
+     *  o hasta que transcurra el timeout (ticks_to_wait, NO_TIMEOUT espera por siempre).
+     *  El dueño puede volver a tomarlo, y debe liberarlo la misma cantidad de veces.
+     *
+     * Retorna OS_OK si se tomo el mutex, u OS_ERROR_TIMEOUT si expiro el timeout.
+***************************************************************************************************/
+os_error os_mutex_lock(os_mutex* mutex, uint32_t ticks_to_wait) {
+
+    os_task* current_task = os_get_current_task();
+    os_task* owner;
+    uint8_t priority;
+    os_error result = OS_OK;
+
+    // a mutex has a task as owner, so it cannot be used from an ISR
+    if (os_get_global_state() == OS_STATE_ISR)  {
+        os_set_error(OS_ERROR_MUTEX_FROM_ISR, os_mutex_lock);
+        return OS_ERROR_MUTEX_FROM_ISR;
+    }
+
+    os_enter_critical_section();
+
+    if (mutex->owner == NULL)   {
+        mutex->owner = current_task;
+        mutex->recursion_count = 1;
+        current_task->mutexes_held++;
+    }
+    else if (mutex->owner == current_task)  {
+        mutex->recursion_count++;
     }
     else    {
-        return false;
+        // priority inheritance: the owner runs at least at the priority of the waiting task
+        owner = mutex->owner;
+        if (current_task->priority < owner->priority)   {
+            os_set_inherited_priority(owner, current_task->priority);
+        }
+
+        // os_mutex_unlock() hands the mutex over to the highest priority waiting task
+        result = os_wait_on_list(&mutex->waiting_tasks, ticks_to_wait);
+
+        // on timeout, the owner (if it only holds this mutex) drops the priority inherited
+        // from this task, keeping the one of the remaining waiting tasks
+        owner = mutex->owner;
+        if (result != OS_OK && owner != NULL && owner->mutexes_held == 1)   {
+            priority = owner->base_priority;
+            if (mutex->waiting_tasks.head != NULL && mutex->waiting_tasks.head->priority < priority)   {
+                priority = mutex->waiting_tasks.head->priority;
+            }
+            if (owner->priority != priority)    {
+                os_set_inherited_priority(owner, priority);
+            }
+        }
     }
-}
 
+    os_exit_critical_section();
+
+    return result;
+}
 
 
 /*************************************************************************************************
-     *  @brief Se libera un semaforo.
+     *  @brief Se libera un mutex. Solo puede liberarlo su dueño.
      *
+     * Cuando el dueño libera el ultimo mutex que tiene, recupera su prioridad original. El mutex
+     * se entrega directamente a la tarea de mayor prioridad que lo estaba esperando.
 ***************************************************************************************************/
-void os_semaphore_give(os_semaphore* semaphore) {
+os_error os_mutex_unlock(os_mutex* mutex)   {
 
     os_task* current_task = os_get_current_task();
+    os_task* new_owner;
+    bool reschedule = false;
+
+    if (os_get_global_state() == OS_STATE_ISR)  {
+        os_set_error(OS_ERROR_MUTEX_FROM_ISR, os_mutex_unlock);
+        return OS_ERROR_MUTEX_FROM_ISR;
+    }
+
+    os_enter_critical_section();
 
-    if (current_task->state == OS_TASK_RUNNING  &&
-        semaphore->taken == true                &&
-        semaphore->associated_task != NULL)
-    {
-        semaphore->taken = false;
-        semaphore->associated_task->state = OS_TASK_READY;
-        semaphore->associated_task->remaining_blocked_ticks = 0;
+    if (mutex->owner != current_task)   {
+        os_exit_critical_section();
+        os_set_error(OS_ERROR_MUTEX_OWNER, os_mutex_unlock);
+        return OS_ERROR_MUTEX_OWNER;
+    }
+
+    mutex->recursion_count--;
+
+    if (mutex->recursion_count == 0)    {
+        current_task->mutexes_held--;
+
+        // the inherited priority is kept until the last mutex is released
+        if (current_task->mutexes_held == 0 && current_task->priority != current_task->base_priority) {
+            os_set_inherited_priority(current_task, current_task->base_priority);
+            reschedule = true;
+        }
+
+        new_owner = os_wake_from_list(&mutex->waiting_tasks);
+        mutex->owner = new_owner;
+
+        if (new_owner != NULL)  {
+            mutex->recursion_count = 1;
+            new_owner->mutexes_held++;
 
-        // if called from an ISR, a new scheduling is required
-        if (os_get_global_state() == OS_STATE_ISR)    {
-            os_set_scheduler_from_isr(true);
+            // the new owner inherits the priority of the tasks still waiting
+            if (mutex->waiting_tasks.head != NULL && mutex->waiting_tasks.head->priority < new_owner->priority)   {
+                os_set_inherited_priority(new_owner, mutex->waiting_tasks.head->priority);
+            }
+            reschedule = true;
         }
     }
+
+    os_exit_critical_section();
+
+    if (reschedule) {
+        os_cpu_yield();
+    }
+
+    return OS_OK;
 }
 
 
 /*************************************************************************************************
-     *  @brief Inicializa una cola.
-     * 
-     * Retorna true si se pudo crear la cola, false si el tamaño del
-     * elemento es mayor al maximo que puede almacenar la cola.
+     *  @brief Inicializa una cola que almacena sus elementos en storage, provisto por el usuario
+     *  (ver OS_QUEUE_STORAGE), con lugar para length elementos de element_size bytes.
+     *
+     * Retorna true si se pudo crear la cola, false si length no es potencia de 2 o los
+     * parametros son invalidos.
 ***************************************************************************************************/
-bool os_queue_init(os_queue* queue, uint16_t element_size) {
-    if (element_size > MAX_QUEUE_SIZE_BYTES)    {
+bool os_queue_init(os_queue* queue, void* storage, uint16_t element_size, uint16_t length) {
+
+    // the length must be a power of 2 so the indexes can wrap around with a mask
+    if (storage == NULL || element_size == 0 || length == 0 || (length & (length - 1)) != 0)  {
         return false;
     }
 
+    queue->data             = storage;
     queue->element_size     = element_size;
-    queue->associated_task  = NULL;
+    queue->mask             = length - 1;
     queue->front            = 0;
     queue->back             = 0;
     queue->current_elements = 0;
+    queue->send_loan        = false;
+    queue->receive_loan     = false;
+    os_wait_list_init(&queue->waiting_senders);
+    os_wait_list_init(&queue->waiting_receivers);
 
     return true;
 }
 
 
 /*************************************************************************************************
-     *  @brief Coloca un dato en una cola.
+     *  @brief Coloca un dato en una cola. Si la cola esta llena, la tarea queda bloqueada hasta
+     *  que haya lugar o hasta que transcurra el timeout (ticks_to_wait = 0 espera por siempre).
+     *  Desde una interrupcion no se bloquea.
      *
+     * Retorna OS_OK si se pudo colocar el dato, OS_ERROR_TIMEOUT si expiro el timeout, u
+     * OS_ERROR_QUEUE_FULL si la cola estaba llena en una interrupcion.
 ***************************************************************************************************/
-bool os_queue_send(os_queue* queue, void* data) {
+os_error os_queue_send(os_queue* queue, const void* data, uint32_t ticks_to_wait) {
 
-    uint16_t total_elements = MAX_QUEUE_SIZE_BYTES / queue->element_size;
-    os_task* current_task   = os_get_current_task();
+    uint32_t start_time = os_get_current_time();
+    os_task* woken_task;
 
-    if (current_task->state == OS_TASK_RUNNING) {
+    os_enter_critical_section();
 
+    // block until the queue has space and no slot is reserved by os_queue_reserve()
+    while (queue->current_elements > queue->mask || queue->send_loan)   {
         // the operation must be canceled if trying to send data
         // to a full queue from an ISR (cannot block inside an ISR)
-        if (os_get_global_state() == OS_STATE_ISR && queue->current_elements == total_elements)  {
-            return false;
+        if (os_get_global_state() == OS_STATE_ISR)  {
+            os_exit_critical_section();
+            return OS_ERROR_QUEUE_FULL;
+        }
+        if (os_wait_on_list_until(&queue->waiting_senders, start_time, ticks_to_wait) != OS_OK)  {
+            os_exit_critical_section();
+            return OS_ERROR_TIMEOUT;
         }
+    }
+
+    woken_task = os_queue_push(queue, data);
+
+    os_exit_critical_section();
+
+    os_schedule_woken_task(woken_task);
+
+    return OS_OK;
+}
+
+
+/*************************************************************************************************
+     *  @brief Version de os_queue_send() para interrupciones, nunca se bloquea. Informa en
+     *  *higher_priority_task_woken si se desperto una tarea de mayor prioridad que la
+     *  interrumpida (ver os_semaphore_give_from_isr()).
+     *
+     * Retorna OS_OK, u OS_ERROR_QUEUE_FULL si la cola estaba llena.
+***************************************************************************************************/
+os_error os_queue_send_from_isr(os_queue* queue, const void* data, bool* higher_priority_task_woken)  {
 
-        // block until the queue has space
-        while (queue->current_elements == total_elements) {
-            os_enter_critical_section();
-            current_task = os_get_current_task();
-            current_task->state     = OS_TASK_BLOCKED;
-            queue->associated_task  = current_task;
+    os_task* woken_task;
+
+    os_enter_critical_section();
+
+    if (queue->current_elements > queue->mask || queue->send_loan)   {
+        os_exit_critical_section();
+        return OS_ERROR_QUEUE_FULL;
+    }
+
+    woken_task = os_queue_push(queue, data);
+
+    os_exit_critical_section();
+
+    os_report_woken_task(woken_task, higher_priority_task_woken);
+
+    return OS_OK;
+}
+
+
+/*************************************************************************************************
+     *  @brief Lee un dato de una cola. Si la cola esta vacia, la tarea queda bloqueada hasta
+     *  que llegue un dato o hasta que transcurra el timeout (ticks_to_wait = 0 espera por
+     *  siempre). Desde una interrupcion no se bloquea.
+     *
+     * Retorna OS_OK si se pudo leer un dato, OS_ERROR_TIMEOUT si expiro el timeout, u
+     * OS_ERROR_QUEUE_EMPTY si la cola estaba vacia en una interrupcion.
+***************************************************************************************************/
+os_error os_queue_receive(os_queue* queue, void* data, uint32_t ticks_to_wait)  {
+
+    uint32_t start_time = os_get_current_time();
+    os_task* woken_task;
+
+    os_enter_critical_section();
+
+    // block until the queue is not empty and the front element is not borrowed by os_queue_borrow()
+    while (queue->current_elements == 0 || queue->receive_loan)    {
+        // the operation must be canceled if trying to receive data
+        // from an empty queue from an ISR (cannot block inside an ISR)
+        if (os_get_global_state() == OS_STATE_ISR)  {
             os_exit_critical_section();
-            // force scheduling
-            os_cpu_yield();
+            return OS_ERROR_QUEUE_EMPTY;
         }
+        if (os_wait_on_list_until(&queue->waiting_receivers, start_time, ticks_to_wait) != OS_OK)   {
+            os_exit_critical_section();
+            return OS_ERROR_TIMEOUT;
+        }
+    }
+
+    woken_task = os_queue_pop(queue, data);
+
+    os_exit_critical_section();
+
+    os_schedule_woken_task(woken_task);
+
+    return OS_OK;
+}
+
+
+/*************************************************************************************************
+     *  @brief Version de os_queue_receive() para interrupciones, nunca se bloquea. Informa en
+     *  *higher_priority_task_woken si se desperto una tarea de mayor prioridad que la
+     *  interrumpida (ver os_semaphore_give_from_isr()).
+     *
+     * Retorna OS_OK, u OS_ERROR_QUEUE_EMPTY si la cola estaba vacia.
+***************************************************************************************************/
+os_error os_queue_receive_from_isr(os_queue* queue, void* data, bool* higher_priority_task_woken)  {
+
+    os_task* woken_task;
+
+    os_enter_critical_section();
+
+    if (queue->current_elements == 0 || queue->receive_loan)    {
+        os_exit_critical_section();
+        return OS_ERROR_QUEUE_EMPTY;
+    }
+
+    woken_task = os_queue_pop(queue, data);
+
+    os_exit_critical_section();
+
+    os_report_woken_task(woken_task, higher_priority_task_woken);
+
+    return OS_OK;
+}
+
+
+
+/*************************************************************************************************
+     *  @brief Coloca count datos consecutivos en una cola con una sola llamada, copiando
+     *  bloques enteros de elementos. Si la cola se llena, la tarea queda bloqueada hasta que
+     *  haya lugar para el resto o hasta que transcurra el timeout (ticks_to_wait = 0 espera por
+     *  siempre). Desde una interrupcion no se bloquea.
+     *
+     * Retorna la cantidad de datos colocados (menos que count si expiro el timeout o si la cola se
+     * lleno en una interrupcion).
+***************************************************************************************************/
+uint16_t os_queue_send_batch(os_queue* queue, const void* data, uint16_t count, uint32_t ticks_to_wait) {
+
+    uint32_t start_time = os_get_current_time();
+    const uint8_t* source = data;
+    uint16_t sent = 0;
+    uint16_t span;
+    os_task* woken_task = NULL;
+    os_task* task;
 
-        // if there was a task blocked waiting to receive an element from an empty queue,
-        // it must go to the READY state if the queue is not empty anymore
-        if (queue->current_elements == 0 && queue->associated_task != NULL) {
-            if (queue->associated_task->state == OS_TASK_BLOCKED)   {
-                queue->associated_task->state = OS_TASK_READY;
+    os_enter_critical_section();
 
-                // if called from an ISR, a new scheduling is required
-                if (os_get_global_state() == OS_STATE_ISR)    {
-                    os_set_scheduler_from_isr(true);
-                }
+    while (sent < count)    {
+        span = queue->send_loan ? 0 : queue->mask + 1 - queue->current_elements;
+
+        // block until the queue has space (cannot block inside an ISR)
+        if (span == 0)  {
+            if (os_get_global_state() == OS_STATE_ISR ||
+                os_wait_on_list_until(&queue->waiting_senders, start_time, ticks_to_wait) != OS_OK)  {
+                break;
             }
+            continue;
+        }
+
+        if (span > count - sent)    {
+            span = count - sent;
         }
 
-        // if the queue has enough space, copy the data to the
-        // corresponding block of memory inside the queue data
-        memcpy(queue->data + queue->front *  queue->element_size, data, queue->element_size);
-        queue->front = (queue->front + 1) % total_elements;
-        queue->associated_task = NULL;
-        queue->current_elements++;
+        os_ring_write(queue->data, queue->mask, queue->front, queue->element_size, source + sent * queue->element_size, span);
+        queue->front = (queue->front + span) & queue->mask;
+        queue->current_elements += span;
+        sent += span;
+
+        // one receiver can take each new element, the first one woken has the highest priority
+        while (span-- > 0 && (task = os_wake_from_list(&queue->waiting_receivers)) != NULL)  {
+            if (woken_task == NULL) {
+                woken_task = task;
+            }
+        }
     }
 
-    return true;
+    os_exit_critical_section();
+
+    os_schedule_woken_task(woken_task);
+
+    return sent;
 }
 
 
 /*************************************************************************************************
-     *  @brief Lee un dato de una cola.
+     *  @brief Lee hasta max_count datos de una cola con una sola llamada, copiando bloques
+     *  enteros de elementos. Si la cola esta vacia, la tarea queda bloqueada hasta que llegue
+     *  un dato o hasta que transcurra el timeout (ticks_to_wait = 0 espera por siempre).
+     *  Desde una interrupcion no se bloquea.
      *
+     * Retorna la cantidad de datos leidos (0 si expiro el timeout o si la cola estaba vacia en una
+     * interrupcion).
 ***************************************************************************************************/
-bool os_queue_receive(os_queue* queue, void* data)  {
+uint16_t os_queue_receive_batch(os_queue* queue, void* data, uint16_t max_count, uint32_t ticks_to_wait)  {
 
-    uint16_t total_elements = MAX_QUEUE_SIZE_BYTES / queue->element_size;
-    os_task* current_task   = os_get_current_task();
+    uint32_t start_time = os_get_current_time();
+    uint16_t count;
+    uint16_t freed;
+    os_task* woken_task = NULL;
+    os_task* task;
 
-    if (current_task->state == OS_TASK_RUNNING) {
+    os_enter_critical_section();
 
-        // the operation must be canceled if trying to receive data
-        // from an empty queue from an ISR (cannot block inside an ISR)
-        if (os_get_global_state() == OS_STATE_ISR && queue->current_elements == 0)  {
-            return false;
+    // block until the queue is not empty
+    while (queue->current_elements == 0 || queue->receive_loan)    {
+        // cannot block inside an ISR
+        if (os_get_global_state() == OS_STATE_ISR ||
+            os_wait_on_list_until(&queue->waiting_receivers, start_time, ticks_to_wait) != OS_OK)  {
+            os_exit_critical_section();
+            return 0;
         }
+    }
+
+    count = (queue->current_elements < max_count) ? queue->current_elements : max_count;
+
+    os_ring_read(queue->data, queue->mask, queue->back, queue->element_size, data, count);
+    queue->back = (queue->back + count) & queue->mask;
+    queue->current_elements -= count;
+
+    // one sender can use each free slot, the first one woken has the highest priority
+    freed = count;
+    while (freed-- > 0 && (task = os_wake_from_list(&queue->waiting_senders)) != NULL)  {
+        if (woken_task == NULL) {
+            woken_task = task;
+        }
+    }
+
+    os_exit_critical_section();
+
+    os_schedule_woken_task(woken_task);
+
+    return count;
+}
+
+
+/*************************************************************************************************
+     *  @brief Reserva el proximo lugar libre de una cola para completarlo sin copias, y devuelve
+     *  un puntero a el dentro de la memoria de la cola. El dato no es visible para los receptores
+     *  hasta llamar a os_queue_commit(). Si la cola esta llena, la tarea queda bloqueada hasta
+     *  que haya lugar o hasta que transcurra el timeout (ticks_to_wait = 0 espera por siempre).
+     *  Desde una interrupcion no se bloquea.
+     *
+     * Solo puede haber una reserva a la vez: los demas emisores esperan hasta el commit.
+     * Retorna el puntero al lugar reservado, o NULL si expiro el timeout o no habia lugar en una
+     * interrupcion.
+***************************************************************************************************/
+void* os_queue_reserve(os_queue* queue, uint32_t ticks_to_wait)   {
+
+    uint32_t start_time = os_get_current_time();
+    void* slot;
 
-        // block until the queue is not empty
-        while (queue->current_elements == 0)    {
-            os_enter_critical_section();
-            current_task = os_get_current_task();
-            current_task->state     = OS_TASK_BLOCKED;
-            queue->associated_task  = current_task;
+    os_enter_critical_section();
+
+    // block until the queue has space and no other slot is reserved
+    while (queue->current_elements > queue->mask || queue->send_loan)   {
+        // cannot block inside an ISR
+        if (os_get_global_state() == OS_STATE_ISR ||
+            os_wait_on_list_until(&queue->waiting_senders, start_time, ticks_to_wait) != OS_OK)  {
             os_exit_critical_section();
-            // force scheduling
-            os_cpu_yield();
+            return NULL;
         }
+    }
 
-        // if there was a task blocked waiting to send an element to a full queue,
-        // it must go to the READY state if the queue has space now
-        if (queue->current_elements == total_elements && queue->associated_task != NULL) {
-            if (queue->associated_task->state == OS_TASK_BLOCKED)   {
-                queue->associated_task->state = OS_TASK_READY;
+    queue->send_loan = true;
+    slot = queue->data + queue->front * queue->element_size;
 
-                // if called from an ISR, a new scheduling is required
-                if (os_get_global_state() == OS_STATE_ISR)    {
-                    os_set_scheduler_from_isr(true);
-                }
-            }
+    os_exit_critical_section();
+
+    return slot;
+}
+
+
+/*************************************************************************************************
+     *  @brief Agrega a la cola el dato completado en el lugar obtenido con os_queue_reserve().
+     *
+***************************************************************************************************/
+void os_queue_commit(os_queue* queue)  {
+
+    os_task* woken_task;
+    os_task* task;
+
+    os_enter_critical_section();
+
+    if (!queue->send_loan)  {
+        os_exit_critical_section();
+        return;
+    }
+
+    queue->send_loan = false;
+    queue->front = (queue->front + 1) & queue->mask;
+    queue->current_elements++;
+
+    // a receiver can take the new element, and a sender waiting for the reservation can go on
+    woken_task = os_wake_from_list(&queue->waiting_receivers);
+    if (queue->current_elements <= queue->mask) {
+        task = os_wake_from_list(&queue->waiting_senders);
+        if (woken_task == NULL || (task != NULL && task->priority < woken_task->priority))    {
+            woken_task = task;
         }
+    }
+
+    os_exit_critical_section();
+
+    os_schedule_woken_task(woken_task);
+}
+
+
+/*************************************************************************************************
+     *  @brief Presta el primer dato de una cola para leerlo sin copias, y devuelve un puntero a
+     *  el dentro de la memoria de la cola. El lugar no se libera hasta llamar a
+     *  os_queue_release(). Si la cola esta vacia, la tarea queda bloqueada hasta que llegue un
+     *  dato o hasta que transcurra el timeout (ticks_to_wait = 0 espera por siempre).
+     *  Desde una interrupcion no se bloquea.
+     *
+     * Solo puede haber un prestamo a la vez: los demas receptores esperan hasta el release.
+     * Retorna el puntero al dato, o NULL si expiro el timeout o la cola estaba vacia en una
+     * interrupcion.
+***************************************************************************************************/
+void* os_queue_borrow(os_queue* queue, uint32_t ticks_to_wait)    {
+
+    uint32_t start_time = os_get_current_time();
+    void* slot;
+
+    os_enter_critical_section();
 
-        memcpy(data, queue->data + queue->back *  queue->element_size, queue->element_size);
-        queue->back = (queue->back + 1) % total_elements;
-        queue->associated_task = NULL;
-        queue->current_elements--;
+    // block until the queue is not empty and the front element is not already borrowed
+    while (queue->current_elements == 0 || queue->receive_loan)    {
+        // cannot block inside an ISR
+        if (os_get_global_state() == OS_STATE_ISR ||
+            os_wait_on_list_until(&queue->waiting_receivers, start_time, ticks_to_wait) != OS_OK)  {
+            os_exit_critical_section();
+            return NULL;
+        }
     }
 
-    return true;
+    queue->receive_loan = true;
+    slot = queue->data + queue->back * queue->element_size;
+
+    os_exit_critical_section();
+
+    return slot;
+}
+
+
+/*************************************************************************************************
+     *  @brief Libera el lugar del dato obtenido con os_queue_borrow().
+     *
+***************************************************************************************************/
+void os_queue_release(os_queue* queue) {
+
+    os_task* woken_task;
+    os_task* task;
+
+    os_enter_critical_section();
+
+    if (!queue->receive_loan)   {
+        os_exit_critical_section();
+        return;
+    }
+
+    queue->receive_loan = false;
+    queue->back = (queue->back + 1) & queue->mask;
+    queue->current_elements--;
+
+    // a sender can use the free slot, and a receiver waiting for the loan can go on
+    woken_task = os_wake_from_list(&queue->waiting_senders);
+    if (queue->current_elements > 0)    {
+        task = os_wake_from_list(&queue->waiting_receivers);
+        if (woken_task == NULL || (task != NULL && task->priority < woken_task->priority))    {
+            woken_task = task;
+        }
+    }
+
+    os_exit_critical_section();
+
+    os_schedule_woken_task(woken_task);
+}
+
+
+/*************************************************************************************************
+     *  @brief Inicializa un stream buffer de size bytes que almacena los datos en storage,
+     *  provisto por el usuario (ver OS_STREAM_BUFFER_STORAGE).
+     *  La tarea bloqueada leyendo solo se despierta cuando hay al menos trigger_level bytes, o
+     *  con os_stream_buffer_flush().
+     *
+     * Retorna true si se pudo crear el stream buffer, false si size no es potencia de 2 o los
+     * parametros son invalidos.
+***************************************************************************************************/
+bool os_stream_buffer_init(os_stream_buffer* stream, void* storage, uint16_t size, uint16_t trigger_level)    {
+
+    // the size must be a power of 2 so the indexes can wrap around with a mask
+    if (storage == NULL || size == 0 || (size & (size - 1)) != 0)   {
+        return false;
+    }
+
+    if (trigger_level == 0) {
+        trigger_level = 1;
+    }
+    else if (trigger_level > size)  {
+        trigger_level = size;
+    }
+
+    stream->data            = storage;
+    stream->mask            = size - 1;
+    stream->trigger_level   = trigger_level;
+    stream->head            = 0;
+    stream->tail            = 0;
+    stream->used            = 0;
+    os_wait_list_init(&stream->waiting_writers);
+    os_wait_list_init(&stream->waiting_readers);
+
+    return true;
+}
+
+
+/*************************************************************************************************
+     *  @brief Escribe length bytes en un stream buffer, copiando bloques enteros. Si el buffer
+     *  se llena, la tarea queda bloqueada hasta que haya lugar para el resto o hasta que
+     *  transcurra el timeout (ticks_to_wait = 0 espera por siempre). Desde una interrupcion no
+     *  se bloquea y solo se escribe lo que entra.
+     *
+     * Retorna la cantidad de bytes escritos (menos que length si expiro el timeout o si el buffer
+     * se lleno en una interrupcion).
+***************************************************************************************************/
+uint16_t os_stream_buffer_write(os_stream_buffer* stream, const void* data, uint16_t length, uint32_t ticks_to_wait)  {
+
+    uint32_t start_time = os_get_current_time();
+    const uint8_t* source = data;
+    uint16_t written = 0;
+    os_task* woken_task = NULL;
+
+    os_enter_critical_section();
+
+    written = os_stream_buffer_push(stream, source, length, &woken_task);
+
+    // block until the buffer has space for the rest (cannot block inside an ISR)
+    while (written < length && os_get_global_state() != OS_STATE_ISR)    {
+        if (os_wait_on_list_until(&stream->waiting_writers, start_time, ticks_to_wait) != OS_OK)  {
+            break;
+        }
+        written += os_stream_buffer_push(stream, source + written, length - written, &woken_task);
+    }
+
+    os_exit_critical_section();
+
+    os_schedule_woken_task(woken_task);
+
+    return written;
+}
+
+
+/*************************************************************************************************
+     *  @brief Version de os_stream_buffer_write() para interrupciones, nunca se bloquea y solo
+     *  escribe lo que entra. Informa en *higher_priority_task_woken si se desperto una tarea de
+     *  mayor prioridad que la interrumpida (ver os_semaphore_give_from_isr()).
+     *
+     * Retorna la cantidad de bytes escritos.
+***************************************************************************************************/
+uint16_t os_stream_buffer_write_from_isr(os_stream_buffer* stream, const void* data, uint16_t length, bool* higher_priority_task_woken)  {
+
+    uint16_t written;
+    os_task* woken_task = NULL;
+
+    os_enter_critical_section();
+    written = os_stream_buffer_push(stream, data, length, &woken_task);
+    os_exit_critical_section();
+
+    os_report_woken_task(woken_task, higher_priority_task_woken);
+
+    return written;
+}
+
+
+/*************************************************************************************************
+     *  @brief Lee hasta max_length bytes de un stream buffer, copiando bloques enteros.
+     *  Si el buffer esta vacio, la tarea queda bloqueada hasta que haya al menos trigger_level
+     *  bytes o hasta que transcurra el timeout (ticks_to_wait = 0 espera por siempre), y en ese
+     *  caso lee los que haya; si ya tiene datos, se leen sin esperar. Desde una interrupcion no
+     *  se bloquea.
+     *
+     * Retorna la cantidad de bytes leidos (0 si expiro el timeout sin datos o si el buffer estaba
+     * vacio en una interrupcion).
+***************************************************************************************************/
+uint16_t os_stream_buffer_read(os_stream_buffer* stream, void* data, uint16_t max_length, uint32_t ticks_to_wait)  {
+
+    uint32_t start_time = os_get_current_time();
+    uint16_t length;
+    os_task* woken_task;
+
+    os_enter_critical_section();
+
+    // block until the buffer is not empty; on timeout the bytes below the trigger level are read
+    while (stream->used == 0)   {
+        // cannot block inside an ISR
+        if (os_get_global_state() == OS_STATE_ISR ||
+            os_wait_on_list_until(&stream->waiting_readers, start_time, ticks_to_wait) != OS_OK)  {
+            break;
+        }
+    }
+
+    if (stream->used == 0)  {
+        os_exit_critical_section();
+        return 0;
+    }
+
+    length = (stream->used < max_length) ? stream->used : max_length;
+
+    os_ring_read(stream->data, stream->mask, stream->tail, 1, data, length);
+    stream->tail = (stream->tail + length) & stream->mask;
+    stream->used -= length;
+
+    // every blocked writer checks if the rest of its data fits now, the first one woken has the
+    // highest priority. Those that still do not fit block again
+    woken_task = os_wake_from_list(&stream->waiting_writers);
+    while (os_wake_from_list(&stream->waiting_writers) != NULL) {
+    }
+
+    os_exit_critical_section();
+
+    os_schedule_woken_task(woken_task);
+
+    return length;
+}
+
+
+/*************************************************************************************************
+     *  @brief Despierta a la tarea bloqueada leyendo un stream buffer aunque no se haya alcanzado
+     *  el nivel de disparo, para que lea los bytes que haya (por ejemplo al final de un mensaje).
+     *  Puede llamarse desde una interrupcion.
+     *
+***************************************************************************************************/
+void os_stream_buffer_flush(os_stream_buffer* stream)   {
+
+    os_task* woken_task = NULL;
+
+    os_enter_critical_section();
+
+    if (stream->used > 0)   {
+        woken_task = os_wake_from_list(&stream->waiting_readers);
+    }
+
+    os_exit_critical_section();
+
+    os_schedule_woken_task(woken_task);
+}
+
+
+/*************************************************************************************************
+     *  @brief Inicializa un buffer circular lock-free para un unico productor y un unico
+     *  consumidor (por ejemplo una interrupcion y una tarea), que almacena sus elementos en
+     *  storage, provisto por el usuario (ver OS_QUEUE_STORAGE).
+     *
+     * Retorna true si se pudo crear el buffer, false si length no es potencia de 2 o los
+     * parametros son invalidos.
+***************************************************************************************************/
+bool os_spsc_ring_init(os_spsc_ring* ring, void* storage, uint16_t element_size, uint16_t length)  {
+
+    // the length must be a power of 2 so the indexes can wrap around with a mask
+    if (storage == NULL || element_size == 0 || length == 0 || (length & (length - 1)) != 0)  {
+        return false;
+    }
+
+    ring->data              = storage;
+    ring->element_size      = element_size;
+    ring->mask              = length - 1;
+    ring->head              = 0;
+    ring->tail              = 0;
+    ring->consumer_waiting  = false;
+    os_wait_list_init(&ring->waiting_consumer);
+
+    return true;
+}
+
+
+/*************************************************************************************************
+     *  @brief Coloca un dato en el buffer. Solo puede llamarla el productor, y nunca bloquea ni
+     *  deshabilita interrupciones (salvo para despertar al consumidor si esta esperando en
+     *  os_spsc_ring_receive_wait()).
+     *
+     * Retorna true si se pudo colocar el dato, false si el buffer estaba lleno.
+***************************************************************************************************/
+bool os_spsc_ring_send(os_spsc_ring* ring, const void* data)  {
+
+    os_task* woken_task = NULL;
+    bool sent;
+
+    sent = os_spsc_ring_push(ring, data, &woken_task);
+
+    os_schedule_woken_task(woken_task);
+
+    return sent;
+}
+
+
+/*************************************************************************************************
+     *  @brief Version de os_spsc_ring_send() para un productor que es una interrupcion. Informa
+     *  en *higher_priority_task_woken si se desperto una tarea de mayor prioridad que la
+     *  interrumpida (ver os_semaphore_give_from_isr()).
+     *
+     * Retorna true si se pudo colocar el dato, false si el buffer estaba lleno.
+***************************************************************************************************/
+bool os_spsc_ring_send_from_isr(os_spsc_ring* ring, const void* data, bool* higher_priority_task_woken)  {
+
+    os_task* woken_task = NULL;
+    bool sent;
+
+    sent = os_spsc_ring_push(ring, data, &woken_task);
+
+    os_report_woken_task(woken_task, higher_priority_task_woken);
+
+    return sent;
+}
+
+
+/*************************************************************************************************
+     *  @brief Lee un dato del buffer. Solo puede llamarla el consumidor, y nunca bloquea ni
+     *  deshabilita interrupciones.
+     *
+     * Retorna true si se pudo leer un dato, false si el buffer estaba vacio.
+***************************************************************************************************/
+bool os_spsc_ring_receive(os_spsc_ring* ring, void* data)  {
+
+    uint32_t tail = ring->tail;
+
+    if (ring->head == tail) {
+        return false;
+    }
+
+    // the element must be read after seeing the head that published it
+    __DMB();
+    memcpy(data, ring->data + (tail & ring->mask) * ring->element_size, ring->element_size);
+
+    // and before the producer can see the slot as free
+    __DMB();
+    ring->tail = tail + 1;
+
+    return true;
+}
+
+
+/*************************************************************************************************
+     *  @brief Lee un dato del buffer, bloqueando a la tarea consumidora hasta que llegue uno o
+     *  hasta que transcurra el timeout (ticks_to_wait = 0 espera por siempre).
+     *  El camino sin espera no deshabilita interrupciones.
+     *
+     * Retorna OS_OK si se pudo leer un dato, u OS_ERROR_TIMEOUT.
+***************************************************************************************************/
+os_error os_spsc_ring_receive_wait(os_spsc_ring* ring, void* data, uint32_t ticks_to_wait)   {
+
+    os_error error = OS_OK;
+
+    while (!os_spsc_ring_receive(ring, data))   {
+
+        os_enter_critical_section();
+
+        // the producer only enters a critical section if it sees this flag, so the ring is
+        // checked again after setting it in case an element arrived in between
+        ring->consumer_waiting = true;
+        if (ring->head == ring->tail)   {
+            error = os_wait_on_list(&ring->waiting_consumer, ticks_to_wait);
+        }
+        ring->consumer_waiting = false;
+
+        os_exit_critical_section();
+
+        if (error != OS_OK) {
+            return error;
+        }
+    }
+
+    return OS_OK;
+}
+
+
+/*************************************************************************************************
+     *  @brief Inicializa un pool de block_count bloques de block_size bytes, que almacena los
+     *  bloques en storage, provisto por el usuario (ver OS_POOL_STORAGE).
+     *  Los bloques libres forman una lista enlazada guardando el puntero al siguiente en su
+     *  primera palabra, por lo que el tamaño se redondea a multiplo de 4 bytes.
+     *
+     * Retorna true si se pudo crear el pool, false si los parametros son invalidos.
+***************************************************************************************************/
+bool os_pool_init(os_pool* pool, void* storage, uint16_t block_size, uint16_t block_count)  {
+
+    uint8_t* block;
+
+    if (storage == NULL || block_size == 0 || block_count == 0 || ((uint32_t)storage & 0x3) != 0)    {
+        return false;
+    }
+
+    pool->storage           = storage;
+    pool->block_size        = OS_POOL_BLOCK_SIZE(block_size);
+    pool->block_count       = block_count;
+    pool->free_blocks       = block_count;
+    pool->min_free_blocks   = block_count;
+    pool->failed_allocs     = 0;
+    os_wait_list_init(&pool->waiting_tasks);
+
+    // link every block to the next one
+    block = pool->storage;
+    for (uint16_t i=0; i<block_count-1; i++)    {
+        *(void**)block = block + pool->block_size;
+        block += pool->block_size;
+    }
+    *(void**)block = NULL;
+    pool->free_list = storage;
+
+    return true;
+}
+
+
+/*************************************************************************************************
+     *  @brief Pide un bloque de un pool. Si no hay bloques libres, la tarea queda bloqueada hasta
+     *  que se libere uno o hasta que transcurra el timeout (ticks_to_wait).
+     *  ticks_to_wait = 0 significa que no hay timeout.
+     *
+     * Retorna el bloque, o NULL si expiro el timeout o se llamo desde una interrupcion sin bloques
+     * libres (desde interrupciones usar os_pool_alloc_from_isr()).
+***************************************************************************************************/
+void* os_pool_alloc(os_pool* pool, uint32_t ticks_to_wait)   {
+
+    uint32_t start_time = os_get_current_time();
+    void* block;
+
+    os_enter_critical_section();
+
+    // a higher priority task or an ISR may take the freed block before this task runs,
+    // so it waits again only for the rest of the timeout
+    while (pool->free_list == NULL) {
+        if (os_get_global_state() == OS_STATE_ISR ||
+            os_wait_on_list_until(&pool->waiting_tasks, start_time, ticks_to_wait) != OS_OK)  {
+            pool->failed_allocs++;
+            os_exit_critical_section();
+            return NULL;
+        }
+    }
+
+    block = os_pool_take_block(pool);
+
+    os_exit_critical_section();
+
+    return block;
+}
+
+
+/*************************************************************************************************
+     *  @brief Pide un bloque de un pool desde una interrupcion, sin bloquear.
+     *
+     * Retorna el bloque, o NULL si no habia bloques libres.
+***************************************************************************************************/
+void* os_pool_alloc_from_isr(os_pool* pool)  {
+
+    void* block = NULL;
+
+    os_enter_critical_section();
+
+    if (pool->free_list != NULL)    {
+        block = os_pool_take_block(pool);
+    }
+    else    {
+        pool->failed_allocs++;
+    }
+
+    os_exit_critical_section();
+
+    return block;
+}
+
+
+/*************************************************************************************************
+     *  @brief Devuelve un bloque a un pool, y despierta a la tarea de mayor prioridad que este
+     *  esperando un bloque.
+     *
+     * Retorna OS_OK, u OS_ERROR_POOL_BLOCK si el bloque no pertenece al pool o ya estaba libre.
+***************************************************************************************************/
+os_error os_pool_free(os_pool* pool, void* block)    {
+
+    os_task* woken_task;
+
+    os_enter_critical_section();
+
+    if (!os_pool_can_free_block(pool, block))   {
+        os_exit_critical_section();
+        os_set_error(OS_ERROR_POOL_BLOCK, os_pool_free);
+        return OS_ERROR_POOL_BLOCK;
+    }
+
+    woken_task = os_pool_put_block(pool, block);
+    os_exit_critical_section();
+
+    os_schedule_woken_task(woken_task);
+
+    return OS_OK;
+}
+
+
+/*************************************************************************************************
+     *  @brief Devuelve un bloque a un pool desde una interrupcion. Informa en
+     *  *higher_priority_task_woken si se desperto una tarea de mayor prioridad que la
+     *  interrumpida (ver os_semaphore_give_from_isr()).
+     *
+     * Retorna OS_OK, u OS_ERROR_POOL_BLOCK si el bloque no pertenece al pool o ya estaba libre.
+***************************************************************************************************/
+os_error os_pool_free_from_isr(os_pool* pool, void* block, bool* higher_priority_task_woken)   {
+
+    os_task* woken_task;
+
+    os_enter_critical_section();
+
+    if (!os_pool_can_free_block(pool, block))   {
+        os_exit_critical_section();
+        os_set_error(OS_ERROR_POOL_BLOCK, os_pool_free_from_isr);
+        return OS_ERROR_POOL_BLOCK;
+    }
+
+    woken_task = os_pool_put_block(pool, block);
+    os_exit_critical_section();
+
+    os_report_woken_task(woken_task, higher_priority_task_woken);
+
+    return OS_OK;
+}
+
+
+/*************************************************************************************************
+     *  @brief Estadisticas de uso de un pool: bloques libres, minima cantidad de bloques libres
+     *  desde la inicializacion, y cantidad de pedidos que no se pudieron satisfacer.
+     *
+***************************************************************************************************/
+uint16_t os_pool_get_free_blocks(os_pool* pool)  {
+    return pool->free_blocks;
+}
+
+uint16_t os_pool_get_min_free_blocks(os_pool* pool)  {
+    return pool->min_free_blocks;
+}
+
+uint32_t os_pool_get_failed_allocs(os_pool* pool)    {
+    return pool->failed_allocs;
+}
+
+
+/*************************************************************************************************
+     *  @brief Inicializa un grupo de eventos con todos los bits en 0.
+     *
+***************************************************************************************************/
+void os_event_group_init(os_event_group* group)  {
+    group->bits = 0;
+    os_wait_list_init(&group->waiting_tasks);
+}
+
+
+/*************************************************************************************************
+     *  @brief Setea bits de un grupo de eventos, y despierta a todas las tareas cuya condicion de
+     *  espera se cumple. Desde una interrupcion se usa os_event_group_set_from_isr().
+     *
+     * Los bits pedidos con OS_EVENT_CLEAR_ON_EXIT por las tareas despertadas se limpian luego de
+     * revisar a todas las tareas, por lo que todas ven los mismos bits.
+     * Retorna los bits del grupo luego de la operacion.
+***************************************************************************************************/
+uint32_t os_event_group_set(os_event_group* group, uint32_t bits) {
+
+    os_task* woken_task;
+    uint32_t result;
+
+    os_enter_critical_section();
+    woken_task = os_event_group_update(group, bits);
+    result = group->bits;
+    os_exit_critical_section();
+
+    os_schedule_woken_task(woken_task);
+
+    return result;
+}
+
+
+/*************************************************************************************************
+     *  @brief Version de os_event_group_set() para interrupciones. Informa en
+     *  *higher_priority_task_woken si se desperto una tarea de mayor prioridad que la
+     *  interrumpida (ver os_semaphore_give_from_isr()).
+     *
+     * Retorna los bits del grupo luego de la operacion.
+***************************************************************************************************/
+uint32_t os_event_group_set_from_isr(os_event_group* group, uint32_t bits, bool* higher_priority_task_woken)   {
+
+    os_task* woken_task;
+    uint32_t result;
+
+    os_enter_critical_section();
+    woken_task = os_event_group_update(group, bits);
+    result = group->bits;
+    os_exit_critical_section();
+
+    os_report_woken_task(woken_task, higher_priority_task_woken);
+
+    return result;
+}
+
+
+/*************************************************************************************************
+     *  @brief Limpia bits de un grupo de eventos.
+     *
+     * Retorna los bits del grupo antes de limpiarlos.
+***************************************************************************************************/
+uint32_t os_event_group_clear(os_event_group* group, uint32_t bits)   {
+
+    uint32_t previous_bits;
+
+    os_enter_critical_section();
+    previous_bits = group->bits;
+    group->bits &= ~bits;
+    os_exit_critical_section();
+
+    return previous_bits;
+}
+
+
+uint32_t os_event_group_get(os_event_group* group) {
+    return group->bits;
+}
+
+
+/*************************************************************************************************
+     *  @brief Espera a que se seteen bits de un grupo de eventos: cualquiera de los bits de mask,
+     *  o todos con OS_EVENT_WAIT_ALL. Con OS_EVENT_CLEAR_ON_EXIT, los bits de mask se limpian al
+     *  cumplirse la condicion. La tarea queda bloqueada hasta que se cumpla la condicion o hasta
+     *  que transcurra el timeout (ticks_to_wait = 0 espera por siempre).
+     *  Desde una interrupcion no se bloquea.
+     *
+     * En bits (puede ser NULL) se devuelven los bits del grupo al cumplirse la condicion (antes de
+     * limpiarlos), o al expirar el timeout.
+     * Retorna OS_OK si se cumplio la condicion, u OS_ERROR_TIMEOUT.
+***************************************************************************************************/
+os_error os_event_group_wait(os_event_group* group, uint32_t mask, uint8_t options, uint32_t ticks_to_wait, uint32_t* bits) {
+
+    os_task* current_task;
+    os_error result = OS_OK;
+    uint32_t value;
+
+    os_enter_critical_section();
+
+    value = group->bits;
+
+    if (os_event_condition_met(value, mask, options))   {
+        if (options & OS_EVENT_CLEAR_ON_EXIT)   {
+            group->bits &= ~mask;
+        }
+    }
+    else if (os_get_global_state() == OS_STATE_ISR) {
+        // cannot block inside an ISR
+        result = OS_ERROR_TIMEOUT;
+    }
+    else    {
+        current_task = os_get_current_task();
+        current_task->wait_bits = mask;
+        current_task->wait_options = options;
+
+        // os_event_group_set() checks the condition, clears the bits and leaves in wait_bits
+        // the bits that woke the task
+        result = os_wait_on_list(&group->waiting_tasks, ticks_to_wait);
+        value = (result == OS_OK) ? current_task->wait_bits : group->bits;
+    }
+
+    os_exit_critical_section();
+
+    if (bits != NULL)   {
+        *bits = value;
+    }
+
+    return result;
+}
+
+
+/*************************************************************************************************
+     *  @brief Envia una notificacion a una tarea, sin ningun objeto intermedio: setea bits de su
+     *  valor de notificacion (OS_NOTIFY_SET_BITS), lo incrementa (OS_NOTIFY_INCREMENT, value no se
+     *  usa) o lo sobreescribe (OS_NOTIFY_OVERWRITE). Si la tarea estaba esperando en
+     *  os_task_notify_wait(), se despierta. Desde una interrupcion se usa os_task_notify_from_isr().
+     *
+***************************************************************************************************/
+void os_task_notify(os_task* task, uint32_t value, os_notify_action action)   {
+
+    os_task* woken_task;
+
+    os_enter_critical_section();
+    woken_task = os_task_notify_update(task, value, action);
+    os_exit_critical_section();
+
+    os_schedule_woken_task(woken_task);
+}
+
+
+/*************************************************************************************************
+     *  @brief Version de os_task_notify() para interrupciones. Informa en
+     *  *higher_priority_task_woken si se desperto una tarea de mayor prioridad que la
+     *  interrumpida (ver os_semaphore_give_from_isr()).
+     *
+***************************************************************************************************/
+void os_task_notify_from_isr(os_task* task, uint32_t value, os_notify_action action, bool* higher_priority_task_woken)  {
+
+    os_task* woken_task;
+
+    os_enter_critical_section();
+    woken_task = os_task_notify_update(task, value, action);
+    os_exit_critical_section();
+
+    os_report_woken_task(woken_task, higher_priority_task_woken);
+}
+
+
+/*************************************************************************************************
+     *  @brief Espera una notificacion para la tarea actual. Si ya hay una pendiente retorna
+     *  inmediatamente; si no, la tarea queda bloqueada hasta que llegue una o hasta que transcurra
+     *  el timeout (ticks_to_wait = 0 espera por siempre).
+     *
+     * En value (puede ser NULL) se devuelve el valor de notificacion, y luego se limpian los bits
+     * de clear_on_exit (0xFFFFFFFF lo vuelve a 0, para usarlo como contador o evento).
+     * Retorna OS_OK si se recibio una notificacion, u OS_ERROR_TIMEOUT (tambien desde una
+     * interrupcion, donde no se puede esperar).
+***************************************************************************************************/
+os_error os_task_notify_wait(uint32_t clear_on_exit, uint32_t ticks_to_wait, uint32_t* value)   {
+
+    os_task* current_task;
+
+    if (os_get_global_state() == OS_STATE_ISR)  {
+        return OS_ERROR_TIMEOUT;
+    }
+
+    os_enter_critical_section();
+
+    current_task = os_get_current_task();
+
+    if (current_task->notification_state != OS_NOTIFICATION_PENDING)   {
+        current_task->notification_state = OS_NOTIFICATION_WAITING;
+
+        os_block_task(current_task, ticks_to_wait);
+        os_exit_critical_section();
+        os_cpu_yield();
+        os_enter_critical_section();
+
+        // a notification may arrive after the timeout expired but before the task ran
+        if (current_task->notification_state != OS_NOTIFICATION_PENDING)   {
+            current_task->notification_state = OS_NOTIFICATION_NONE;
+            os_exit_critical_section();
+            return OS_ERROR_TIMEOUT;
+        }
+    }
+
+    if (value != NULL)  {
+        *value = current_task->notification_value;
+    }
+    current_task->notification_value &= ~clear_on_exit;
+    current_task->notification_state = OS_NOTIFICATION_NONE;
+
+    os_exit_critical_section();
+
+    return OS_OK;
+}
+
+
+/*************************************************************************************************
+     *  @brief Inicializa un timer de software, que queda detenido. Al vencer, la tarea de los
+     *  timers llama a callback; con auto_reload vuelve a vencer cada period ticks, si no vence
+     *  una sola vez. El callback no debe bloquearse, ya que demora a los demas timers.
+     *
+     * Retorna true si se pudo crear el timer, false si los parametros son invalidos.
+***************************************************************************************************/
+bool os_timer_init(os_timer* timer, timer_callback callback, void* param, uint32_t period, bool auto_reload)  {
+
+    if (callback == NULL || period == 0)    {
+        return false;
+    }
+
+    timer->callback         = callback;
+    timer->param            = param;
+    timer->period           = period;
+    timer->auto_reload      = auto_reload;
+    timer->remaining_ticks  = 0;
+    timer->active           = false;
+    timer->callback_queued  = false;
+    timer->callback_pending = false;
+    timer->next             = NULL;
+    timer->prev             = NULL;
+    timer->callback_next    = NULL;
+
+    return true;
+}
+
+
+/*************************************************************************************************
+     *  @brief Inicia un timer, que vence period ticks despues. Si ya estaba activo no cambia.
+     *  Puede llamarse desde una interrupcion.
+     *
+***************************************************************************************************/
+void os_timer_start(os_timer* timer)  {
+
+    os_enter_critical_section();
+
+    if (!timer->active) {
+        os_arm_timer(timer, timer->period);
+    }
+
+    os_exit_critical_section();
+}
+
+
+/*************************************************************************************************
+     *  @brief Detiene un timer. Si ya habia vencido y su callback no se ejecuto todavia, ya no se
+     *  ejecuta. Puede llamarse desde una interrupcion.
+     *
+***************************************************************************************************/
+void os_timer_stop(os_timer* timer)   {
+
+    os_enter_critical_section();
+
+    os_disarm_timer(timer);
+    timer->callback_pending = false;
+
+    os_exit_critical_section();
+}
+
+
+/*************************************************************************************************
+     *  @brief Reinicia un timer, que vence period ticks despues, este activo o no.
+     *  Puede llamarse desde una interrupcion.
+     *
+***************************************************************************************************/
+void os_timer_reset(os_timer* timer)  {
+
+    os_enter_critical_section();
+
+    os_disarm_timer(timer);
+    os_arm_timer(timer, timer->period);
+
+    os_exit_critical_section();
+}
+
+
+bool os_timer_is_active(os_timer* timer)   {
+    return timer->active;
+}
+
+/*************************************************************************************************
+     *  @brief Decide si hace falta un scheduling luego de despertar una tarea de una lista de
+     *  espera (woken_task puede ser NULL si no se desperto ninguna).
+     *
+***************************************************************************************************/
+static void os_schedule_woken_task(os_task* woken_task)  {
+
+    if (woken_task == NULL) {
+        return;
+    }
+
+    // if called from an ISR, a new scheduling is required
+    if (os_get_global_state() == OS_STATE_ISR)    {
+        os_set_scheduler_from_isr(true);
+    }
+    // a task with higher priority than the current one must run right away
+    else if (woken_task->priority < os_get_current_task()->priority)   {
+        os_cpu_yield();
+    }
+}
+
+
+/*************************************************************************************************
+     *  @brief Version de os_schedule_woken_task() de las funciones _from_isr: solo informa si la
+     *  tarea despertada tiene mayor prioridad que la interrumpida.
+     *
+***************************************************************************************************/
+static void os_report_woken_task(os_task* woken_task, bool* higher_priority_task_woken)  {
+
+    os_task* current_task;
+
+    if (woken_task == NULL) {
+        return;
+    }
+
+    // before the first context switch there is no interrupted task
+    current_task = os_get_current_task();
+    if (current_task == NULL || woken_task->priority < current_task->priority)  {
+        *higher_priority_task_woken = true;
+    }
+}
+
+
+/*************************************************************************************************
+     *  @brief Libera un semaforo: despierta a la tarea de mayor prioridad que lo espera o, si no
+     *  hay ninguna, incrementa la cuenta. Se debe llamar dentro de una seccion critica.
+     *
+     * Retorna la tarea despertada, o NULL.
+***************************************************************************************************/
+static os_task* os_semaphore_release(os_semaphore* semaphore)   {
+
+    os_task* woken_task = os_wake_from_list(&semaphore->waiting_tasks);
+
+    if (woken_task == NULL && semaphore->count < semaphore->max_count) {
+        semaphore->count++;
+    }
+
+    return woken_task;
+}
+
+
+/*************************************************************************************************
+     *  @brief Coloca un dato al final de una cola con lugar, y despierta a la tarea de mayor
+     *  prioridad que espera recibir. Se debe llamar dentro de una seccion critica.
+     *
+     * Retorna la tarea despertada, o NULL.
+***************************************************************************************************/
+static os_task* os_queue_push(os_queue* queue, const void* data)    {
+
+    // copy the data to the corresponding block of memory inside the queue data
+    memcpy(queue->data + queue->front * queue->element_size, data, queue->element_size);
+    queue->front = (queue->front + 1) & queue->mask;
+    queue->current_elements++;
+
+    // the highest priority task waiting to receive can take the new element
+    return os_wake_from_list(&queue->waiting_receivers);
+}
+
+
+/*************************************************************************************************
+     *  @brief Saca el primer dato de una cola no vacia, y despierta a la tarea de mayor prioridad
+     *  que espera enviar. Se debe llamar dentro de una seccion critica.
+     *
+     * Retorna la tarea despertada, o NULL.
+***************************************************************************************************/
+static os_task* os_queue_pop(os_queue* queue, void* data)   {
+
+    memcpy(data, queue->data + queue->back * queue->element_size, queue->element_size);
+    queue->back = (queue->back + 1) & queue->mask;
+    queue->current_elements--;
+
+    // the highest priority task waiting to send can use the free slot
+    return os_wake_from_list(&queue->waiting_senders);
+}
+
+
+/*************************************************************************************************
+     *  @brief Escribe en un stream buffer hasta length bytes, solo lo que entra, y despierta al
+     *  lector si se alcanzo el nivel de disparo. Se debe llamar dentro de una seccion critica.
+     *
+     * En *woken_task queda la primera tarea despertada (si todavia era NULL).
+     * Retorna la cantidad de bytes escritos.
+***************************************************************************************************/
+static uint16_t os_stream_buffer_push(os_stream_buffer* stream, const uint8_t* source, uint16_t length, os_task** woken_task)  {
+
+    uint16_t span = stream->mask + 1 - stream->used;
+    os_task* task;
+
+    if (span > length)  {
+        span = length;
+    }
+    if (span == 0)  {
+        return 0;
+    }
+
+    os_ring_write(stream->data, stream->mask, stream->head, 1, source, span);
+    stream->head = (stream->head + span) & stream->mask;
+    stream->used += span;
+
+    // the reader is only woken once the trigger level is reached
+    if (stream->used >= stream->trigger_level)  {
+        task = os_wake_from_list(&stream->waiting_readers);
+        if (*woken_task == NULL)    {
+            *woken_task = task;
+        }
+    }
+
+    return span;
+}
+
+
+/*************************************************************************************************
+     *  @brief Coloca un dato en un buffer SPSC. Solo entra en una seccion critica si el
+     *  consumidor esta bloqueado esperando, para despertarlo.
+     *
+     * En *woken_task queda el consumidor despertado, o NULL.
+     * Retorna true si se pudo colocar el dato, false si el buffer estaba lleno.
+***************************************************************************************************/
+static bool os_spsc_ring_push(os_spsc_ring* ring, const void* data, os_task** woken_task)  {
+
+    uint32_t head = ring->head;
+
+    // the indexes run freely, so the difference is the number of elements even after overflowing
+    if (head - ring->tail > ring->mask) {
+        return false;
+    }
+
+    memcpy(ring->data + (head & ring->mask) * ring->element_size, data, ring->element_size);
+
+    // the element must be written before the consumer can see the new head
+    __DMB();
+    ring->head = head + 1;
+
+    // and the new head must be visible before reading the flag: the consumer sets the flag
+    // before checking the head again (see os_spsc_ring_receive_wait())
+    __DMB();
+
+    if (ring->consumer_waiting) {
+        os_enter_critical_section();
+        *woken_task = os_wake_from_list(&ring->waiting_consumer);
+        os_exit_critical_section();
+    }
+
+    return true;
+}
+
+
+/*************************************************************************************************
+     *  @brief Indica si block se puede devolver a un pool: debe ser el inicio de uno de sus
+     *  bloques y no puede estar libre. Se debe llamar dentro de una seccion critica.
+     *
+     * Una liberacion doble solo se detecta si todos los bloques ya estaban libres o si block es
+     * el ultimo bloque liberado, para no recorrer la lista de bloques libres.
+***************************************************************************************************/
+static bool os_pool_can_free_block(os_pool* pool, void* block)  {
+
+    uint32_t offset = (uint8_t*)block - pool->storage;
+
+    if ((uint8_t*)block < pool->storage || offset >= (uint32_t)pool->block_size * pool->block_count ||
+        offset % pool->block_size != 0)    {
+        return false;
+    }
+
+    return pool->free_blocks < pool->block_count && block != pool->free_list;
+}
+
+
+/*************************************************************************************************
+     *  @brief Devuelve un bloque a la lista de bloques libres de un pool, y despierta a la tarea
+     *  de mayor prioridad que espera un bloque. Se debe llamar dentro de una seccion critica.
+     *
+     * Retorna la tarea despertada, o NULL.
+***************************************************************************************************/
+static os_task* os_pool_put_block(os_pool* pool, void* block)   {
+
+    *(void**)block = pool->free_list;
+    pool->free_list = block;
+    pool->free_blocks++;
+
+    return os_wake_from_list(&pool->waiting_tasks);
+}
+
+
+/*************************************************************************************************
+     *  @brief Setea bits de un grupo de eventos y despierta a todas las tareas cuya condicion de
+     *  espera se cumple. Se debe llamar dentro de una seccion critica.
+     *
+     * Los bits pedidos con OS_EVENT_CLEAR_ON_EXIT por las tareas despertadas se limpian luego de
+     * revisar a todas las tareas, por lo que todas ven los mismos bits.
+     * Retorna la tarea despertada de mayor prioridad, o NULL.
+***************************************************************************************************/
+static os_task* os_event_group_update(os_event_group* group, uint32_t bits)    {
+
+    os_task* task;
+    os_task* next_task;
+    os_task* woken_task = NULL;
+    uint32_t bits_to_clear = 0;
+
+    group->bits |= bits;
+
+    task = group->waiting_tasks.head;
+    while (task != NULL)    {
+        // os_unblock_task() reuses the links of the wait list
+        next_task = task->next;
+
+        if (os_event_condition_met(group->bits, task->wait_bits, task->wait_options))   {
+            if (task->wait_options & OS_EVENT_CLEAR_ON_EXIT)    {
+                bits_to_clear |= task->wait_bits;
+            }
+
+            // the task gets the bits that met its condition
+            task->wait_bits = group->bits;
+            os_unblock_task(task);
+
+            // the list is ordered by priority, so the first task woken has the highest one
+            if (woken_task == NULL) {
+                woken_task = task;
+            }
+        }
+
+        task = next_task;
+    }
+
+    group->bits &= ~bits_to_clear;
+
+    return woken_task;
+}
+
+
+/*************************************************************************************************
+     *  @brief Actualiza el valor de notificacion de una tarea y la despierta si estaba esperando
+     *  en os_task_notify_wait(). Se debe llamar dentro de una seccion critica.
+     *
+     * Retorna la tarea si fue despertada, o NULL.
+***************************************************************************************************/
+static os_task* os_task_notify_update(os_task* task, uint32_t value, os_notify_action action)   {
+
+    os_task* woken_task = NULL;
+
+    switch (action) {
+        case OS_NOTIFY_SET_BITS:
+            task->notification_value |= value;
+            break;
+        case OS_NOTIFY_INCREMENT:
+            task->notification_value++;
+            break;
+        case OS_NOTIFY_OVERWRITE:
+            task->notification_value = value;
+            break;
+    }
+
+    if (task->notification_state == OS_NOTIFICATION_WAITING && task->state == OS_TASK_BLOCKED)    {
+        os_unblock_task(task);
+        woken_task = task;
+    }
+    task->notification_state = OS_NOTIFICATION_PENDING;
+
+    return woken_task;
+}
+
+
+/*************************************************************************************************
+     *  @brief Copia count elementos de element_size bytes a un buffer circular de mask + 1
+     *  elementos, a partir de index. Como mucho son dos copias (antes y despues del final).
+     *
+***************************************************************************************************/
+static void os_ring_write(uint8_t* ring, uint16_t mask, uint16_t index, uint16_t element_size, const uint8_t* source, uint16_t count)  {
+
+    // elements until the end of the buffer
+    uint16_t first = mask + 1 - index;
+
+    if (first > count)  {
+        first = count;
+    }
+
+    memcpy(ring + index * element_size, source, first * element_size);
+    memcpy(ring, source + first * element_size, (count - first) * element_size);
+}
+
+
+/*************************************************************************************************
+     *  @brief Copia count elementos de element_size bytes desde un buffer circular de mask + 1
+     *  elementos, a partir de index. Como mucho son dos copias (antes y despues del final).
+     *
+***************************************************************************************************/
+static void os_ring_read(const uint8_t* ring, uint16_t mask, uint16_t index, uint16_t element_size, uint8_t* destination, uint16_t count)  {
+
+    // elements until the end of the buffer
+    uint16_t first = mask + 1 - index;
+
+    if (first > count)  {
+        first = count;
+    }
+
+    memcpy(destination, ring + index * element_size, first * element_size);
+    memcpy(destination + first * element_size, ring, (count - first) * element_size);
+}
+
+
+/*************************************************************************************************
+     *  @brief Saca el primer bloque de la lista de bloques libres de un pool. Se debe llamar
+     *  dentro de una seccion critica, con la lista no vacia.
+     *
+***************************************************************************************************/
+static void* os_pool_take_block(os_pool* pool)   {
+
+    void* block = pool->free_list;
+
+    pool->free_list = *(void**)block;
+    pool->free_blocks--;
+    if (pool->free_blocks < pool->min_free_blocks)  {
+        pool->min_free_blocks = pool->free_blocks;
+    }
+
+    return block;
+}
+
+
+/*************************************************************************************************
+     *  @brief Indica si los bits de un grupo de eventos cumplen la condicion de espera de una
+     *  tarea (cualquiera de los bits de mask, o todos con OS_EVENT_WAIT_ALL).
+     *
+***************************************************************************************************/
+static bool os_event_condition_met(uint32_t bits, uint32_t mask, uint8_t options)   {
+
+    if (options & OS_EVENT_WAIT_ALL)    {
+        return (bits & mask) == mask;
+    }
+
+    return (bits & mask) != 0;
 }
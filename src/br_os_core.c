@@ -5,15 +5,45 @@
  *      Author: mbrignone
  */
 
+#include <stddef.h>
 #include "br_os_core.h"
 
 #define IDLE_TASK_ID    0xFF
+#define TIMER_TASK_ID   0xFE
 
+// SysTick_Config() settings (core clock, interrupt enabled), written as a whole so that stopping
+// the counter does not read CTRL, which would clear COUNTFLAG
+#define SYSTICK_CTRL_STOPPED    (SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk)
+#define SYSTICK_CTRL_RUNNING    (SYSTICK_CTRL_STOPPED | SysTick_CTRL_ENABLE_Msk)
 
-// partial initialization so all the rest of the fields are set to 0
-static os_control os_controller = {.number_of_tasks = 0};
+
+// partial initialization so all the rest of the fields are set to 0 (state is OS_STATE_STOPPED)
+// it is not static because PendSV_Handler reads current_task and next_task directly,
+// and os_isr_enter()/os_isr_exit() (inline, br_os_core.h) update the ISR nesting counter
+os_control os_controller = {.number_of_tasks = 0};
+
+// offsets used by PendSV_Handler (see PendSV_Handler.S), only built for the target
+// (the host simulation in sim/ has 64 bit pointers and replaces PendSV_Handler)
+#if defined(__arm__)
+_Static_assert(offsetof(os_control, current_task) == 0, "PendSV_Handler expects current_task at offset 0");
+_Static_assert(offsetof(os_control, next_task) == 4, "PendSV_Handler expects next_task at offset 4");
+_Static_assert(offsetof(os_task, stack_pointer) == 0, "PendSV_Handler expects stack_pointer at offset 0");
+#endif
+
+_Static_assert(OS_NVIC_PRIO_BITS == __NVIC_PRIO_BITS, "OS_NVIC_PRIO_BITS (br_os_config.h) must match the NVIC of the target");
+
+// BASEPRI = 0 does not mask any interrupt
+_Static_assert(!OS_USE_BASEPRI || (OS_MAX_SYSCALL_INTERRUPT_PRIORITY > 0 &&
+               OS_MAX_SYSCALL_INTERRUPT_PRIORITY < (1 << __NVIC_PRIO_BITS)),
+               "OS_MAX_SYSCALL_INTERRUPT_PRIORITY must be between 1 and the lowest NVIC priority");
 
 static os_task idle_task_instance;
+static OS_TASK_STACK(idle_task_stack, OS_IDLE_STACK_SIZE);
+
+#if OS_USE_TIMERS
+static os_task timer_task_instance;
+static OS_TASK_STACK(timer_task_stack, OS_TIMER_STACK_SIZE);
+#endif
 
 /*************************************************************************************************
      *  @brief Inicializa idle task.
@@ -23,10 +53,80 @@ static void os_init_idle_task();
 
 
 /*************************************************************************************************
-     *  @brief Ordena las tareas de acuerdo a sus prioridades.
+     *  @brief Inicializa la tarea que ejecuta los callbacks de los timers.
+     *
+***************************************************************************************************/
+static void os_init_timer_task(void);
+
+
+/*************************************************************************************************
+     *  @brief Inicializa el stack de una tarea con el contexto inicial.
+     *
+***************************************************************************************************/
+static void os_init_task_stack(os_task* task, task_function entry_point, void* task_param);
+
+
+/*************************************************************************************************
+     *  @brief Agrega una tarea al final de la lista de tareas listas de su prioridad.
      *
 ***************************************************************************************************/
-static void os_order_task_priority();
+static void os_ready_list_insert(os_task* task);
+
+
+/*************************************************************************************************
+     *  @brief Quita una tarea de la lista de tareas listas de su prioridad.
+     *
+***************************************************************************************************/
+static void os_ready_list_remove(os_task* task);
+
+
+/*************************************************************************************************
+     *  @brief Agrega una tarea a la lista de tareas demoradas, ordenada por vencimiento.
+     *
+***************************************************************************************************/
+static void os_delay_list_insert(os_task* task, uint32_t ticks);
+
+
+/*************************************************************************************************
+     *  @brief Quita una tarea de la lista de tareas demoradas.
+     *
+***************************************************************************************************/
+static void os_delay_list_remove(os_task* task);
+
+
+/*************************************************************************************************
+     *  @brief Agrega una tarea a una lista de espera, ordenada por prioridad.
+     *
+***************************************************************************************************/
+static void os_wait_list_insert(os_wait_list* wait_list, os_task* task);
+
+
+/*************************************************************************************************
+     *  @brief Quita una tarea de la lista de espera en la que esta bloqueada.
+     *
+***************************************************************************************************/
+static void os_wait_list_remove(os_task* task);
+
+
+/*************************************************************************************************
+     *  @brief Procesa los timers vencidos en este tick, y despierta a la tarea de los timers.
+     *
+***************************************************************************************************/
+static void os_timer_tick(void);
+
+
+/*************************************************************************************************
+     *  @brief Devuelve la cantidad de ticks que puede dormir el sistema sin atrasar a ninguna tarea.
+     *
+***************************************************************************************************/
+static uint32_t os_get_expected_idle_ticks(void);
+
+
+/*************************************************************************************************
+     *  @brief Actualiza el tiempo del sistema con los ticks salteados por el modo tickless.
+     *
+***************************************************************************************************/
+static void os_tick_compensate(uint32_t ticks);
 
 
 /*************************************************************************************************
@@ -42,7 +142,11 @@ static void os_set_pendsv();
 ***************************************************************************************************/
 void __attribute__((weak)) idle_task(void* task_param)  {
     while(1)    {
+#if OS_USE_TICKLESS_IDLE
+        os_tickless_idle();
+#else
         __WFI();
+#endif
     }
 }
 
@@ -68,6 +172,27 @@ void __attribute__((weak)) os_tick_hook(void)  {
 
 
 
+/*************************************************************************************************
+     *  @brief Hook de desborde de stack de una tarea
+     *
+***************************************************************************************************/
+void __attribute__((weak)) os_stack_overflow_hook(os_task* task)  {
+    while(1);
+}
+
+
+
+/*************************************************************************************************
+     *  @brief Hook de llamada al OS desde una interrupcion con prioridad mayor que
+     *  OS_MAX_SYSCALL_INTERRUPT_PRIORITY, que las secciones criticas no enmascaran.
+     *
+***************************************************************************************************/
+void __attribute__((weak)) os_isr_priority_hook(void)  {
+    while(1);
+}
+
+
+
 /*************************************************************************************************
      *  @brief Hook de error de sistema
      *
@@ -82,7 +207,8 @@ void __attribute__((weak)) error_hook(void *caller)  {
      *  @brief Inicializa las tareas del OS.
      *
 ***************************************************************************************************/
-os_error os_init_task(task_function entry_point, os_task* task, void* task_param, uint8_t priority) {
+os_error os_init_task(task_function entry_point, os_task* task, void* task_param, uint8_t priority,
+                      uint32_t* stack, uint32_t stack_size)    {
 
     static uint8_t id = 0;
 
@@ -95,25 +221,38 @@ os_error os_init_task(task_function entry_point, os_task* task, void* task_param
         os_set_error(OS_ERROR_MAX_TASK, os_init_task);
         return OS_ERROR_MAX_TASK;
     }
+    else if (stack == NULL || stack_size < OS_MIN_STACK_SIZE ||
+             (stack_size & 0x7) != 0 || ((uint32_t)stack & 0x7) != 0)  {
+        // the top of the stack must be 8 byte aligned
+        os_set_error(OS_ERROR_STACK_SIZE, os_init_task);
+        return OS_ERROR_STACK_SIZE;
+    }
     else    {
 
-        task->stack[STACK_SIZE/4 - XPSR]    = INIT_XPSR;                    // required for bit thumb
-        task->stack[STACK_SIZE/4 - PC_REG]  = (uint32_t)entry_point;        // pointer to the task (entry point)
-        task->stack[STACK_SIZE/4 - LR]      = (uint32_t)os_return_hook;     // task return (should never happen)
-
-        task->stack[STACK_SIZE/4 - R0]      = (uint32_t)task_param;         // task parameter
-
-        task->stack[STACK_SIZE/4 - LR_PREV_VALUE] = EXEC_RETURN;
-        task->stack_pointer = (uint32_t) (task->stack + STACK_SIZE/4 - FULL_STACKING_SIZE);
+        task->stack = stack;
+        task->stack_size = stack_size;
+        os_init_task_stack(task, entry_point, task_param);
 
         task->entry_point = entry_point;
         task->id = id;
         task->state = OS_TASK_READY;
         task->priority = priority;
+        task->base_priority = priority;
+        task->mutexes_held = 0;
+        task->remaining_blocked_ticks = 0;
+        task->delay_next = NULL;
+        task->delay_prev = NULL;
+        task->wait_list = NULL;
+        task->timed_out = false;
+        task->wait_bits = 0;
+        task->wait_options = 0;
+        task->notification_value = 0;
+        task->notification_state = OS_NOTIFICATION_NONE;
 
         os_controller.task_list[id] = task;
         os_controller.number_of_tasks++;
-        os_controller.tasks_per_priority[priority]++;
+
+        os_ready_list_insert(task);
 
         id++;
 
@@ -139,16 +278,26 @@ void os_init(void)  {
     os_controller.next_task                 = NULL;
     os_controller.current_critical_sections = 0;
     os_controller.schedule_from_isr         = false;
+    os_controller.isr_nesting               = 0;
     os_controller.system_time               = 0;
+    os_controller.delay_list                = NULL;
+    os_controller.timer_list                = NULL;
+    os_controller.callback_head             = NULL;
+    os_controller.callback_tail             = NULL;
+    os_controller.elided_ticks              = 0;
+    os_controller.context_switches          = 0;
+    os_controller.avoided_context_switches  = 0;
+
+    // SysTick must already be configured, its reload value is the period of one tick
+    os_controller.tick_cycles               = SysTick->LOAD + 1;
+
+    os_init_timer_task();
 
     for (uint8_t i=0; i<OS_MAX_TASK; i++)	{
         if (i >= os_controller.number_of_tasks)	{
             os_controller.task_list[i] = NULL;
         }
     }
-
-    // order all the tasks inside the OS controller based on their priorities
-    os_order_task_priority();
 }
 
 
@@ -191,10 +340,60 @@ uint32_t os_get_current_time(void)  {
 }
 
 /*************************************************************************************************
-     *  @brief Devuelve el estado actual del OS.
+     *  @brief Devuelve la cantidad de ticks salteados por el modo tickless desde que se inicio el OS.
+     *
+***************************************************************************************************/
+uint32_t os_get_elided_ticks(void)  {
+    return os_controller.elided_ticks;
+}
+
+/*************************************************************************************************
+     *  @brief Devuelve la cantidad de cambios de contexto realizados desde que se inicio el OS.
+     *
+***************************************************************************************************/
+uint32_t os_get_context_switches(void)  {
+    return os_controller.context_switches;
+}
+
+/*************************************************************************************************
+     *  @brief Devuelve la cantidad de pasadas del scheduler que mantuvieron la tarea actual,
+     *  evitando el PendSV, desde que se inicio el OS.
+     *
+***************************************************************************************************/
+uint32_t os_get_avoided_context_switches(void)  {
+    return os_controller.avoided_context_switches;
+}
+
+/*************************************************************************************************
+     *  @brief Devuelve la maxima cantidad de bytes del stack que utilizo una tarea (high-water
+     *  mark), contando las palabras que aun tienen el patron desde el fondo del stack.
+     *  Con task = NULL devuelve el de la idle task.
+     *
+***************************************************************************************************/
+uint32_t os_get_stack_high_water_mark(os_task* task)    {
+    uint32_t words, unused_words = 0;
+
+    if (task == NULL)   {
+        task = &idle_task_instance;
+    }
+
+    words = task->stack_size/4;
+    while (unused_words < words && task->stack[unused_words] == OS_STACK_FILL_PATTERN)  {
+        unused_words++;
+    }
+
+    return (words - unused_words) * 4;
+}
+
+/*************************************************************************************************
+     *  @brief Devuelve el estado actual del OS. Dentro de una interrupcion (entre os_isr_enter()
+     *  y os_isr_exit()) es OS_STATE_ISR.
      *
 ***************************************************************************************************/
 os_state os_get_global_state(void)  {
+    if (os_controller.isr_nesting > 0)  {
+        return OS_STATE_ISR;
+    }
     return os_controller.state;
 }
 
@@ -231,155 +430,312 @@ bool os_get_scheduler_from_isr(void)    {
 /*************************************************************************************************
      *  @brief Funcion que efectua las decisiones de scheduling.
      *
+     * La prioridad mas alta con tareas listas se obtiene con un unico __CLZ sobre el bitmap
+     * de prioridades listas, por lo que el costo no depende de la cantidad de tareas bloqueadas.
 ***************************************************************************************************/
 static void scheduler(void)  {
-    static uint8_t index_per_priority[OS_N_PRIORITY]; // must be static for Round-robin between tasks of the same priority
+    uint8_t priority;
+    os_task* selected_task;
+    bool switch_required;
 
-    uint8_t index_offset = 0;
-    uint8_t real_index = 0;
-    uint8_t total_iterated_tasks = 0;
-    uint8_t priority_iterated_tasks = 0;
-    uint8_t current_priority = OS_MAX_PRIORITY;
+    // nothing to schedule until os_init() is called
+    if (os_controller.state == OS_STATE_STOPPED)    {
+        return;
+    }
 
-    if (os_controller.state == OS_STATE_RESET)  {
-        // consider the possibility of having no tasks
-        if (os_controller.number_of_tasks > 0)  {
-            // task_list is ordered, so the first task will have the higher priority
-            os_controller.current_task = os_controller.task_list[0];
-        }
-        else    {
-            os_controller.current_task = &idle_task_instance;
-        }
-        // the index array must be set to zero
-        for (uint8_t i=0; i<OS_N_PRIORITY; i++) {
-            index_per_priority[i] = 0;
-        }
+    os_enter_critical_section();
+
+    if (os_controller.ready_bitmap == 0)    {
+        // all tasks are blocked (or there are no tasks), so the idle task must be run
+        selected_task = &idle_task_instance;
     }
     else    {
-        // iterate over all tasks until a READY/RUNNING task is found
-        while (total_iterated_tasks < os_controller.number_of_tasks)  {
-
-            priority_iterated_tasks = 0;
-            // iterate over all the tasks of the current priority
-            while (priority_iterated_tasks < os_controller.tasks_per_priority[current_priority])    {
-                real_index = index_per_priority[current_priority] + index_offset;
-
-                if(((os_controller.task_list[real_index]))->state != OS_TASK_BLOCKED)  {
-                    // select next task and update the index, so the same task is not chosen again the next time
-                    os_controller.next_task = os_controller.task_list[real_index];
-                    index_per_priority[current_priority] = (index_per_priority[current_priority] + 1) % os_controller.tasks_per_priority[current_priority];
-                    break;  // break inner while
-                }
-
-                // go to the next task of the current priority
-                index_per_priority[current_priority] = (index_per_priority[current_priority] + 1) % os_controller.tasks_per_priority[current_priority];
-                priority_iterated_tasks++;
-            }
+        priority = __CLZ(os_controller.ready_bitmap);
+        selected_task = os_controller.ready_list[priority];
 
-            // all the tasks of the current priority are blocked, so go to the next priority
-            if (priority_iterated_tasks == os_controller.tasks_per_priority[current_priority])  {
+        // advance the head so the next task of the same priority is chosen the next time (Round-robin)
+        os_controller.ready_list[priority] = selected_task->next;
+    }
 
-                index_offset = index_offset + os_controller.tasks_per_priority[current_priority];
-                total_iterated_tasks = total_iterated_tasks + priority_iterated_tasks;
-                current_priority++;
-            }
-            // the next READY task was found, so break out of the outer while
-            else    {
-                break;  // break outer while
-            }
-        }
+    // the first context switch does not save the context of any task (current_task is NULL)
+    if (os_controller.state == OS_STATE_RESET)  {
+        os_controller.state = OS_STATE_NORMAL;
+    }
 
-        // all tasks are blocked, so the idle task must be run
-        if (total_iterated_tasks == os_controller.number_of_tasks)    {
-            os_controller.next_task = &idle_task_instance;
-        }
+    switch_required = (selected_task != os_controller.current_task);
 
+    // task states are updated here so PendSV_Handler only swaps stack pointers; a previous
+    // decision not yet performed by PendSV (next_task) is replaced by this one.
+    // only RUNNING tasks go to READY, if a task was BLOCKED it should stay BLOCKED
+    if (os_controller.next_task != NULL && os_controller.next_task->state == OS_TASK_RUNNING)   {
+        os_controller.next_task->state = OS_TASK_READY;
+    }
+    if (os_controller.current_task != NULL && os_controller.current_task->state == OS_TASK_RUNNING) {
+        os_controller.current_task->state = OS_TASK_READY;
+    }
+    selected_task->state = OS_TASK_RUNNING;
+    os_controller.next_task = selected_task;
+
+#if OS_CHECK_STACK_OVERFLOW
+    // the lowest word of the stack of the task being switched out must still have the pattern
+    if (switch_required && os_controller.current_task != NULL &&
+        os_controller.current_task->stack[0] != OS_STACK_FILL_PATTERN)    {
+        os_set_error(OS_ERROR_STACK_OVERFLOW, os_controller.current_task);
+        os_stack_overflow_hook(os_controller.current_task);
+    }
+#endif
 
+    if (switch_required)    {
+        os_controller.context_switches++;
     }
+    else    {
+        // a previous decision of this same interrupt burst may have left PendSV pending
+        SCB->ICSR = SCB_ICSR_PENDSVCLR_Msk;
+        os_controller.avoided_context_switches++;
+    }
+
+    os_exit_critical_section();
 
-    // set PendSV exception to do the context switch after scheduling
-    os_set_pendsv();
+    // set PendSV exception to do the context switch after scheduling, only if the task changes
+    if (switch_required)    {
+        os_set_pendsv();
+    }
 }
 
 
 
+/*************************************************************************************************
+     *  @brief Pide un scheduling al salir de la interrupcion si higher_priority_task_woken es true
+     *  (el resultado de las funciones _from_isr). El scheduling se hace una sola vez, al salir de
+     *  la interrupcion mas externa (os_isr_exit()).
+     *
+***************************************************************************************************/
+void os_yield_from_isr(bool higher_priority_task_woken)    {
+    if (higher_priority_task_woken) {
+        os_controller.schedule_from_isr = true;
+    }
+}
+
+
 /*************************************************************************************************
      *  @brief SysTick Handler.
      *
 ***************************************************************************************************/
 void SysTick_Handler(void)  {
 
+    os_task* expired_task;
+
+    if (os_controller.state == OS_STATE_STOPPED)    {
+        return;
+    }
+
+    os_isr_enter();
+
+    os_enter_critical_section();
+
     // update system time
     os_controller.system_time++;
 
-    // update the remaining blocked ticks for all the corresponding tasks
-    for (uint8_t i; i<os_controller.number_of_tasks; i++)   {
-        if (os_controller.task_list[i]->remaining_blocked_ticks > 0)    {
-            os_controller.task_list[i]->remaining_blocked_ticks--;
-
-            // update the task state if the remaining ticks are 0
-            // it must be done here to avoid updating the state if it was
-            // blocked for another reason
-            if (os_controller.task_list[i]->state == OS_TASK_BLOCKED && os_controller.task_list[i]->remaining_blocked_ticks == 0)    {
+    // the delay list stores the ticks relative to the previous task, so only the
+    // head has to be decremented; every task that reaches 0 has expired
+    expired_task = os_controller.delay_list;
+    if (expired_task != NULL)   {
+        expired_task->remaining_blocked_ticks--;
 
-                os_controller.task_list[i]->state = OS_TASK_READY;
-            }
+        while (expired_task != NULL && expired_task->remaining_blocked_ticks == 0)  {
+            expired_task->timed_out = true;
+            os_unblock_task(expired_task);
+            expired_task = os_controller.delay_list;
         }
     }
 
-    scheduler();
+    os_timer_tick();
+
+    os_exit_critical_section();
+
+    // every tick ends with a scheduling decision (round-robin), made once the outermost interrupt exits
+    os_controller.schedule_from_isr = true;
 
     os_tick_hook();
+
+    os_isr_exit();
 }
 
 
 
 
 /*************************************************************************************************
-     *  @brief Funcion para determinar el proximo contexto.
+     *  @brief Detiene el SysTick y duerme hasta idle_ticks ticks, o hasta que llegue otra
+     *  interrupcion. Se llama con las interrupciones deshabilitadas.
      *
+     * Devuelve la cantidad de ticks que transcurrieron sin ser atendidos por SysTick_Handler.
+     * Si el SysTick vencio, su interrupcion queda pendiente y cuenta el ultimo tick, por lo que
+     * no se incluye. Es weak para poder reemplazarla en otro hardware o en una simulacion.
 ***************************************************************************************************/
-uint32_t get_next_context(uint32_t current_stack_pointer)  {
-    uint32_t next_stack_pointer;
+uint32_t __attribute__((weak)) os_suppress_ticks_and_sleep(uint32_t idle_ticks)  {
+    uint32_t tick_cycles = os_controller.tick_cycles;
+    uint32_t max_ticks = SysTick_LOAD_RELOAD_Msk / tick_cycles;
+    uint32_t reload, remaining_cycles, elapsed_cycles, pending_ticks;
+
+    // a tick that already expired must be handled first
+    if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+        return 0;
+    }
 
-    if (os_controller.state == OS_STATE_RESET)	{
-        next_stack_pointer = os_controller.current_task->stack_pointer;
-        os_controller.current_task->state = OS_TASK_RUNNING;
-        os_controller.state = OS_STATE_NORMAL;
+    if (idle_ticks > max_ticks) {
+        idle_ticks = max_ticks;
     }
-    else {
-        os_controller.current_task->stack_pointer = current_stack_pointer;
-    
-        // only go to READY if the task was RUNNING
-        // if it was BLOCKED, it should stay BLOCKED
-        if (os_controller.current_task->state == OS_TASK_RUNNING)   {
-            os_controller.current_task->state = OS_TASK_READY;
-        }
 
-        next_stack_pointer = os_controller.next_task->stack_pointer;
+    SysTick->CTRL = SYSTICK_CTRL_STOPPED;
+
+    // the tick may have expired right before the counter stopped
+    if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+        SysTick->CTRL = SYSTICK_CTRL_RUNNING;
+        return 0;
+    }
+
+    // the cycles left in the current tick are kept, so the wakeup stays aligned to the tick.
+    // The counter expires reload + 1 cycles after it is started
+    reload = SysTick->VAL + tick_cycles * (idle_ticks - 1) - 1;
+    SysTick->LOAD = reload;
+    SysTick->VAL = 0;       // also clears COUNTFLAG
+    SysTick->CTRL = SYSTICK_CTRL_RUNNING;
+
+    __DSB();
+    __WFI();
+    __ISB();
+
+    // stopped before checking COUNTFLAG, so the counter cannot expire between both
+    SysTick->CTRL = SYSTICK_CTRL_STOPPED;
 
-        os_controller.current_task = os_controller.next_task;
-        os_controller.current_task->state = OS_TASK_RUNNING;
+    if (SysTick->CTRL & SysTick_CTRL_COUNTFLAG_Msk) {
+        // the whole period elapsed and SysTick_Handler counts its last tick. The counter
+        // reloaded when it expired, so the next tick is one tick after that (or a whole
+        // tick from now if the CPU took almost a tick to wake up)
+        pending_ticks = 1;
+        elapsed_cycles = (SysTick->VAL == 0) ? 0 : reload - SysTick->VAL + 1;
+        remaining_cycles = (elapsed_cycles + 2 <= tick_cycles) ? tick_cycles - elapsed_cycles : tick_cycles;
+    }
+    else    {
+        // woken up by another interrupt, the next tick keeps the original alignment
+        remaining_cycles = SysTick->VAL;
+        pending_ticks = (remaining_cycles + tick_cycles - 1) / tick_cycles;
+        remaining_cycles = remaining_cycles - (pending_ticks - 1) * tick_cycles;
     }
 
-    return next_stack_pointer;
+    // a reload value of 0 would stop the counter
+    SysTick->LOAD = (remaining_cycles > 1) ? remaining_cycles - 1 : 1;
+    SysTick->VAL = 0;
+    SysTick->CTRL = SYSTICK_CTRL_RUNNING;
+    SysTick->LOAD = tick_cycles - 1;    // used from the next reload on
+
+    return idle_ticks - pending_ticks;
 }
 
 
 /*************************************************************************************************
-     *  @brief Inicializa Idle Task.
+     *  @brief Idle del modo tickless. Si solo la idle task esta lista, detiene el SysTick hasta
+     *  el proximo vencimiento de la lista de tareas demoradas en lugar de despertar en cada tick.
      *
 ***************************************************************************************************/
-static void os_init_idle_task()    {
+void os_tickless_idle(void) {
+    uint32_t idle_ticks, elided_ticks;
+
+    // WFI wakes up with a pending interrupt even if PRIMASK is set, so no event is lost.
+    // PRIMASK is used even with OS_USE_BASEPRI, interrupts masked by BASEPRI do not wake up WFI
+    __disable_irq();
+
+    idle_ticks = os_get_expected_idle_ticks();
+
+    if (idle_ticks >= OS_TICKLESS_MIN_IDLE_TICKS)   {
+        elided_ticks = os_suppress_ticks_and_sleep(idle_ticks);
+        os_tick_compensate(elided_ticks);
+    }
+    else    {
+        __DSB();
+        __WFI();
+    }
+
+    __enable_irq();
+}
+
+
+/*************************************************************************************************
+     *  @brief Devuelve la cantidad de ticks que puede dormir el sistema sin atrasar a ninguna tarea.
+     *
+***************************************************************************************************/
+static uint32_t os_get_expected_idle_ticks(void)    {
+
+    uint32_t idle_ticks = UINT32_MAX;
+
+    if (os_controller.ready_bitmap != 0)    {
+        return 0;
+    }
+
+    if (os_controller.delay_list != NULL)   {
+        idle_ticks = os_controller.delay_list->remaining_blocked_ticks;
+    }
+
+    // the first timer to expire must also be handled on time
+    if (os_controller.timer_list != NULL && os_controller.timer_list->remaining_ticks < idle_ticks)  {
+        idle_ticks = os_controller.timer_list->remaining_ticks;
+    }
+
+    return idle_ticks;
+}
+
+
+/*************************************************************************************************
+     *  @brief Actualiza el tiempo del sistema con los ticks salteados por el modo tickless.
+     *
+     * Siempre son menos que los ticks restantes del primer elemento de la lista de demoras y de la
+ * lista de timers.
+***************************************************************************************************/
+static void os_tick_compensate(uint32_t ticks)  {
+    os_controller.system_time += ticks;
+    os_controller.elided_ticks += ticks;
+
+    if (os_controller.delay_list != NULL)   {
+        os_controller.delay_list->remaining_blocked_ticks -= ticks;
+    }
+
+    if (os_controller.timer_list != NULL)   {
+        os_controller.timer_list->remaining_ticks -= ticks;
+    }
+}
+
 
-    idle_task_instance.stack[STACK_SIZE/4 - XPSR]    = INIT_XPSR;                    // required for bit thumb
-    idle_task_instance.stack[STACK_SIZE/4 - PC_REG]  = (uint32_t)idle_task;          // pointer to the task (entry point)
-    idle_task_instance.stack[STACK_SIZE/4 - LR]      = (uint32_t)os_return_hook;     // task return (should never happen)
 
-    idle_task_instance.stack[STACK_SIZE/4 - R0]      = (uint32_t)NULL;               // task parameter
+#if OS_USE_C_CONTEXT_SWITCH
+/*************************************************************************************************
+     *  @brief Cambio de contexto en C, llamado desde PendSV_Handler con OS_USE_C_CONTEXT_SWITCH.
+     *  Hace lo mismo que PendSV_Handler hace en assembler, para comparar ambas versiones.
+     *
+     * Recibe el stack pointer de la tarea actual (sin uso en el primer cambio de contexto) y
+     * devuelve el de la proxima tarea.
+***************************************************************************************************/
+uint32_t get_next_context(uint32_t current_stack_pointer)  {
+
+    if (os_controller.current_task != NULL) {
+        os_controller.current_task->stack_pointer = current_stack_pointer;
+    }
+
+    os_controller.current_task = os_controller.next_task;
+
+    return os_controller.current_task->stack_pointer;
+}
+#endif
+
+
+/*************************************************************************************************
+     *  @brief Inicializa Idle Task.
+     *
+***************************************************************************************************/
+static void os_init_idle_task()    {
 
-    idle_task_instance.stack[STACK_SIZE/4 - LR_PREV_VALUE] = EXEC_RETURN;
-    idle_task_instance.stack_pointer = (uint32_t)(idle_task_instance.stack + STACK_SIZE/4 - FULL_STACKING_SIZE);
+    idle_task_instance.stack = idle_task_stack;
+    idle_task_instance.stack_size = OS_IDLE_STACK_SIZE;
+    os_init_task_stack(&idle_task_instance, idle_task, NULL);
 
     idle_task_instance.entry_point = idle_task;
     idle_task_instance.id = IDLE_TASK_ID;
@@ -388,25 +744,544 @@ static void os_init_idle_task()    {
 }
 
 /*************************************************************************************************
-     *  @brief Ordena las tareas de acuerdo a sus prioridades.
+     *  @brief Tarea que ejecuta los callbacks de los timers vencidos, en el orden en que vencieron.
+     *  Queda bloqueada mientras no haya callbacks pendientes.
      *
 ***************************************************************************************************/
-static void os_order_task_priority()    {
-    // really inefficient bubble sort ( O(N^2) )
-    os_task* swap_variable;
+#if OS_USE_TIMERS
+static void os_timer_task(void* task_param)   {
+    os_timer* timer;
+    bool run_callback;
+
+    while(1)    {
+        os_enter_critical_section();
+
+        timer = os_controller.callback_head;
+        if (timer == NULL)  {
+            // os_timer_tick() unblocks the task when a timer expires
+            os_block_task(&timer_task_instance, NO_TIMEOUT);
+            os_exit_critical_section();
+            os_cpu_yield();
+            continue;
+        }
+
+        os_controller.callback_head = timer->callback_next;
+        if (os_controller.callback_head == NULL)    {
+            os_controller.callback_tail = NULL;
+        }
+        timer->callback_next = NULL;
+        timer->callback_queued = false;
+
+        // the timer may have been stopped after it expired
+        run_callback = timer->callback_pending;
+        timer->callback_pending = false;
+
+        os_exit_critical_section();
+
+        if (run_callback)   {
+            timer->callback(timer);
+        }
+    }
+}
+#endif
 
-    for (uint8_t i=0; i < os_controller.number_of_tasks - 1; i++)  {
-        for (uint8_t j=0; j < os_controller.number_of_tasks - i - 1; j++)   {
 
-            if (((os_controller.task_list[j]))->priority > ((os_controller.task_list[j+1]))->priority)  {
-                swap_variable = os_controller.task_list[j];
-                os_controller.task_list[j] = os_controller.task_list[j+1];
-                os_controller.task_list[j+1] = swap_variable;
+/*************************************************************************************************
+     *  @brief Inicializa la tarea que ejecuta los callbacks de los timers. Como la idle task, no
+     *  ocupa un lugar de la lista de tareas del usuario.
+     *
+***************************************************************************************************/
+static void os_init_timer_task(void)   {
+#if OS_USE_TIMERS
+    os_init_kernel_task(os_timer_task, &timer_task_instance, TIMER_TASK_ID, OS_TIMER_TASK_PRIORITY,
+                        timer_task_stack, sizeof(timer_task_stack));
+#endif
+}
+
+
+/*************************************************************************************************
+     *  @brief Inicializa una tarea del OS (por ejemplo la de los timers), que no ocupa un lugar en
+     *  la lista de tareas de os_init_task() y se identifica con un id propio a partir de 0xFF
+     *  hacia abajo. Puede llamarse antes o despues de os_init().
+     *
+***************************************************************************************************/
+void os_init_kernel_task(task_function entry_point, os_task* task, uint8_t id, uint8_t priority,
+                         uint32_t* stack, uint32_t stack_size)    {
+    task->stack = stack;
+    task->stack_size = stack_size;
+    os_init_task_stack(task, entry_point, NULL);
+
+    task->entry_point = entry_point;
+    task->id = id;
+    task->state = OS_TASK_READY;
+    task->priority = priority;
+    task->base_priority = priority;
+
+    os_enter_critical_section();
+    os_ready_list_insert(task);
+    os_exit_critical_section();
+}
+
+
+/*************************************************************************************************
+     *  @brief Devuelve la tarea de los timers (por ejemplo para medir su stack), o NULL si los
+     *  timers estan deshabilitados.
+     *
+***************************************************************************************************/
+os_task* os_get_timer_task(void)    {
+#if OS_USE_TIMERS
+    return &timer_task_instance;
+#else
+    return NULL;
+#endif
+}
+
+
+/*************************************************************************************************
+     *  @brief Inicializa el stack de una tarea con el contexto inicial.
+     *
+***************************************************************************************************/
+static void os_init_task_stack(os_task* task, task_function entry_point, void* task_param)    {
+    uint32_t words = task->stack_size/4;
+
+    // paint the whole stack, the words that keep the pattern were never used
+    for (uint32_t i=0; i<words; i++)    {
+        task->stack[i] = OS_STACK_FILL_PATTERN;
+    }
+
+    task->stack[words - XPSR]    = INIT_XPSR;                    // required for bit thumb
+    task->stack[words - PC_REG]  = (uint32_t)entry_point;        // pointer to the task (entry point)
+    task->stack[words - LR]      = (uint32_t)os_return_hook;     // task return (should never happen)
+
+    task->stack[words - R0]      = (uint32_t)task_param;         // task parameter
+
+    task->stack[words - LR_PREV_VALUE] = EXEC_RETURN;
+    task->stack_pointer = (uint32_t) (task->stack + words - FULL_STACKING_SIZE);
+}
+
+
+/*************************************************************************************************
+     *  @brief Agrega una tarea al final de la lista de tareas listas de su prioridad.
+     *
+***************************************************************************************************/
+static void os_ready_list_insert(os_task* task)   {
+    os_task** head = &os_controller.ready_list[task->priority];
+
+    if (*head == NULL)  {
+        task->next = task;
+        task->prev = task;
+        *head = task;
+        os_controller.ready_bitmap |= OS_PRIORITY_BIT(task->priority);
+    }
+    else    {
+        // the tail of a circular list is the previous task of the head
+        task->next = *head;
+        task->prev = (*head)->prev;
+        (*head)->prev->next = task;
+        (*head)->prev = task;
+    }
+}
+
+
+/*************************************************************************************************
+     *  @brief Quita una tarea de la lista de tareas listas de su prioridad.
+     *
+***************************************************************************************************/
+static void os_ready_list_remove(os_task* task)   {
+    os_task** head = &os_controller.ready_list[task->priority];
+
+    if (task->next == task) {
+        // it was the only task of its priority
+        *head = NULL;
+        os_controller.ready_bitmap &= ~OS_PRIORITY_BIT(task->priority);
+    }
+    else    {
+        task->prev->next = task->next;
+        task->next->prev = task->prev;
+        if (*head == task)  {
+            *head = task->next;
+        }
+    }
+
+    task->next = NULL;
+    task->prev = NULL;
+}
+
+
+/*************************************************************************************************
+     *  @brief Agrega una tarea a la lista de tareas demoradas, ordenada por vencimiento.
+     *
+     * Cada tarea guarda en remaining_blocked_ticks los ticks que faltan a partir del vencimiento
+     * de la tarea anterior (delta list), por lo que el SysTick solo decrementa la primera.
+***************************************************************************************************/
+static void os_delay_list_insert(os_task* task, uint32_t ticks)   {
+    os_task* previous = NULL;
+    os_task* following = os_controller.delay_list;
+
+    // tasks with the same expiration keep their insertion order
+    while (following != NULL && following->remaining_blocked_ticks <= ticks)  {
+        ticks = ticks - following->remaining_blocked_ticks;
+        previous = following;
+        following = following->delay_next;
+    }
+
+    task->remaining_blocked_ticks = ticks;
+    task->delay_prev = previous;
+    task->delay_next = following;
+
+    if (following != NULL)  {
+        following->remaining_blocked_ticks -= ticks;
+        following->delay_prev = task;
+    }
+
+    if (previous != NULL)   {
+        previous->delay_next = task;
+    }
+    else    {
+        os_controller.delay_list = task;
+    }
+}
+
+
+/*************************************************************************************************
+     *  @brief Quita una tarea de la lista de tareas demoradas.
+     *
+***************************************************************************************************/
+static void os_delay_list_remove(os_task* task)   {
+
+    if (task->delay_next != NULL)   {
+        // the following task inherits the remaining ticks of the removed one
+        task->delay_next->remaining_blocked_ticks += task->remaining_blocked_ticks;
+        task->delay_next->delay_prev = task->delay_prev;
+    }
+
+    if (task->delay_prev != NULL)   {
+        task->delay_prev->delay_next = task->delay_next;
+    }
+    else    {
+        os_controller.delay_list = task->delay_next;
+    }
+
+    task->delay_next = NULL;
+    task->delay_prev = NULL;
+    task->remaining_blocked_ticks = 0;
+}
+
+
+/*************************************************************************************************
+     *  @brief Bloquea una tarea, quitandola de la lista de tareas listas. Si ticks es distinto
+     *  de NO_TIMEOUT, la tarea se desbloquea automaticamente luego de esa cantidad de ticks.
+     *
+***************************************************************************************************/
+void os_block_task(os_task* task, uint32_t ticks)   {
+    os_enter_critical_section();
+
+    if (task->state != OS_TASK_BLOCKED) {
+        os_ready_list_remove(task);
+        task->state = OS_TASK_BLOCKED;
+        task->timed_out = false;
+
+        if (ticks != NO_TIMEOUT)    {
+            os_delay_list_insert(task, ticks);
+        }
+    }
+
+    os_exit_critical_section();
+}
+
+
+/*************************************************************************************************
+     *  @brief Desbloquea una tarea, agregandola al final de la lista de tareas listas.
+     *
+***************************************************************************************************/
+void os_unblock_task(os_task* task) {
+    os_enter_critical_section();
+
+    if (task->state == OS_TASK_BLOCKED) {
+        if (task->delay_prev != NULL || os_controller.delay_list == task)   {
+            os_delay_list_remove(task);
+        }
+        if (task->wait_list != NULL)    {
+            os_wait_list_remove(task);
+        }
+
+        task->state = OS_TASK_READY;
+        os_ready_list_insert(task);
+    }
+
+    os_exit_critical_section();
+}
+
+/*************************************************************************************************
+     *  @brief Cambia la prioridad efectiva de una tarea (herencia de prioridad), manteniendo
+     *  ordenada la lista en la que se encuentra. base_priority no se modifica.
+     *
+***************************************************************************************************/
+void os_set_inherited_priority(os_task* task, uint8_t priority) {
+    os_wait_list* wait_list;
+
+    os_enter_critical_section();
+
+    if (task->state != OS_TASK_BLOCKED) {
+        os_ready_list_remove(task);
+        task->priority = priority;
+        os_ready_list_insert(task);
+    }
+    else if (task->wait_list != NULL)   {
+        wait_list = task->wait_list;
+        os_wait_list_remove(task);
+        task->priority = priority;
+        os_wait_list_insert(wait_list, task);
+    }
+    else    {
+        task->priority = priority;
+    }
+
+    os_exit_critical_section();
+}
+
+
+/*************************************************************************************************
+     *  @brief Inicializa una lista de espera vacia.
+     *
+***************************************************************************************************/
+void os_wait_list_init(os_wait_list* wait_list) {
+    wait_list->head = NULL;
+}
+
+
+/*************************************************************************************************
+     *  @brief Agrega un timer a la lista de timers, que vence en ticks ticks (al menos 1). Como la
+     *  lista de tareas demoradas, guarda los ticks relativos al timer anterior, por lo que
+     *  SysTick_Handler solo revisa el primero. Se debe llamar dentro de una seccion critica.
+     *
+***************************************************************************************************/
+void os_arm_timer(os_timer* timer, uint32_t ticks)  {
+    os_timer* previous = NULL;
+    os_timer* following = os_controller.timer_list;
+
+    // timers with the same expiration keep their insertion order
+    while (following != NULL && following->remaining_ticks <= ticks)  {
+        ticks = ticks - following->remaining_ticks;
+        previous = following;
+        following = following->next;
+    }
+
+    timer->remaining_ticks = ticks;
+    timer->prev = previous;
+    timer->next = following;
+    timer->active = true;
+
+    if (following != NULL)  {
+        following->remaining_ticks -= ticks;
+        following->prev = timer;
+    }
+
+    if (previous != NULL)   {
+        previous->next = timer;
+    }
+    else    {
+        os_controller.timer_list = timer;
+    }
+}
+
+
+/*************************************************************************************************
+     *  @brief Quita un timer de la lista de timers, si estaba en ella. Se debe llamar dentro de
+     *  una seccion critica.
+     *
+***************************************************************************************************/
+void os_disarm_timer(os_timer* timer)   {
+
+    if (!timer->active) {
+        return;
+    }
+
+    if (timer->next != NULL)    {
+        // the following timer inherits the remaining ticks of the removed one
+        timer->next->remaining_ticks += timer->remaining_ticks;
+        timer->next->prev = timer->prev;
+    }
+
+    if (timer->prev != NULL)    {
+        timer->prev->next = timer->next;
+    }
+    else    {
+        os_controller.timer_list = timer->next;
+    }
+
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->remaining_ticks = 0;
+    timer->active = false;
+}
+
+
+/*************************************************************************************************
+     *  @brief Procesa los timers vencidos en este tick: los auto-reload se vuelven a agregar a la
+     *  lista un periodo despues de su vencimiento (sin deriva), y todos pasan a la cola de
+     *  callbacks de la tarea de los timers. Se llama dentro de una seccion critica.
+     *
+***************************************************************************************************/
+static void os_timer_tick(void) {
+#if OS_USE_TIMERS
+    os_timer* expired_timer = os_controller.timer_list;
+
+    if (expired_timer == NULL)  {
+        return;
+    }
+
+    expired_timer->remaining_ticks--;
+
+    while (expired_timer != NULL && expired_timer->remaining_ticks == 0)    {
+        os_disarm_timer(expired_timer);
+        if (expired_timer->auto_reload) {
+            os_arm_timer(expired_timer, expired_timer->period);
+        }
+
+        // if the previous callback did not run yet, it runs only once
+        expired_timer->callback_pending = true;
+        if (!expired_timer->callback_queued)    {
+            expired_timer->callback_queued = true;
+            expired_timer->callback_next = NULL;
+            if (os_controller.callback_tail != NULL)    {
+                os_controller.callback_tail->callback_next = expired_timer;
+            }
+            else    {
+                os_controller.callback_head = expired_timer;
             }
+            os_controller.callback_tail = expired_timer;
         }
+
+        expired_timer = os_controller.timer_list;
+    }
+
+    if (os_controller.callback_head != NULL)    {
+        os_unblock_task(&timer_task_instance);
+    }
+#endif
+}
+
+
+/*************************************************************************************************
+     *  @brief Agrega una tarea a una lista de espera, ordenada por prioridad.
+     *
+***************************************************************************************************/
+static void os_wait_list_insert(os_wait_list* wait_list, os_task* task)   {
+    os_task* previous = NULL;
+    os_task* following = wait_list->head;
+
+    // tasks with the same priority keep their arrival order
+    while (following != NULL && following->priority <= task->priority)   {
+        previous = following;
+        following = following->next;
+    }
+
+    task->prev = previous;
+    task->next = following;
+    task->wait_list = wait_list;
+
+    if (following != NULL)  {
+        following->prev = task;
+    }
+
+    if (previous != NULL)   {
+        previous->next = task;
+    }
+    else    {
+        wait_list->head = task;
+    }
+}
+
+
+/*************************************************************************************************
+     *  @brief Quita una tarea de la lista de espera en la que esta bloqueada.
+     *
+***************************************************************************************************/
+static void os_wait_list_remove(os_task* task)  {
+
+    if (task->next != NULL) {
+        task->next->prev = task->prev;
+    }
+
+    if (task->prev != NULL) {
+        task->prev->next = task->next;
+    }
+    else    {
+        task->wait_list->head = task->next;
+    }
+
+    task->next = NULL;
+    task->prev = NULL;
+    task->wait_list = NULL;
+}
+
+
+/*************************************************************************************************
+     *  @brief Bloquea la tarea actual en una lista de espera, con timeout (NO_TIMEOUT espera
+     *  por siempre), y fuerza el scheduling.
+     *
+     * Se debe llamar desde una tarea con exactamente una seccion critica tomada, en la que se
+     * verifico la condicion de espera. La seccion critica se libera mientras la tarea esta
+     * bloqueada y se vuelve a tomar antes de retornar.
+     * Retorna OS_OK si la tarea fue despertada con os_wake_from_list() u OS_ERROR_TIMEOUT.
+***************************************************************************************************/
+os_error os_wait_on_list(os_wait_list* wait_list, uint32_t ticks)   {
+    os_task* current_task = os_controller.current_task;
+
+    os_block_task(current_task, ticks);
+    os_wait_list_insert(wait_list, current_task);
+
+    os_exit_critical_section();
+    os_cpu_yield();
+    os_enter_critical_section();
+
+    return current_task->timed_out ? OS_ERROR_TIMEOUT : OS_OK;
+}
+
+
+/*************************************************************************************************
+     *  @brief Como os_wait_on_list(), pero el timeout de ticks ticks se cuenta desde start_time
+     *  (ticks = NO_TIMEOUT espera por siempre). Lo usan las operaciones que vuelven a esperar si
+     *  otra tarea les gano el recurso al despertar, para no reiniciar el timeout en cada espera.
+     *
+     * Retorna OS_OK si la tarea fue despertada con os_wake_from_list() u OS_ERROR_TIMEOUT,
+     * tambien sin bloquearse si el timeout ya expiro.
+***************************************************************************************************/
+os_error os_wait_on_list_until(os_wait_list* wait_list, uint32_t start_time, uint32_t ticks)   {
+    uint32_t elapsed_ticks;
+
+    if (ticks == NO_TIMEOUT)    {
+        return os_wait_on_list(wait_list, NO_TIMEOUT);
+    }
+
+    // unsigned arithmetic keeps working when system_time overflows
+    elapsed_ticks = os_controller.system_time - start_time;
+    if (elapsed_ticks >= ticks) {
+        return OS_ERROR_TIMEOUT;
+    }
+
+    return os_wait_on_list(wait_list, ticks - elapsed_ticks);
+}
+
+
+/*************************************************************************************************
+     *  @brief Despierta la tarea de mayor prioridad de una lista de espera. Se debe llamar
+     *  dentro de una seccion critica, y puede llamarse desde una interrupcion.
+     *
+     * Retorna la tarea despertada, o NULL si la lista estaba vacia.
+***************************************************************************************************/
+os_task* os_wake_from_list(os_wait_list* wait_list) {
+    os_task* task = wait_list->head;
+
+    if (task != NULL)   {
+        os_unblock_task(task);
     }
+
+    return task;
 }
 
+
 /*************************************************************************************************
      *  @brief Se fuerza a una ejecución del scheduler.
      *
@@ -435,9 +1310,27 @@ static void os_set_pendsv() {
      *  @brief Inidica el inicio de una seccion critica, en la que las interrupciones no
      *  estan habilitadas, para garantizar que las operaciones sean atomicas.
      *
+     * Con OS_USE_BASEPRI solo se enmascaran las interrupciones con prioridad igual o menor que
+     * OS_MAX_SYSCALL_INTERRUPT_PRIORITY; las de mayor prioridad no sufren latencia del OS, pero
+     * no pueden llamar al OS.
 ***************************************************************************************************/
 inline void os_enter_critical_section(void)    {
+#if OS_USE_BASEPRI
+#if OS_CHECK_ISR_PRIORITY
+    // IPSR holds the exception number, external interrupts start at 16
+    uint32_t exception = __get_IPSR();
+
+    if (exception >= 16 && NVIC_GetPriority((IRQn_Type)(exception - 16)) < OS_MAX_SYSCALL_INTERRUPT_PRIORITY)  {
+        os_set_error(OS_ERROR_ISR_PRIORITY, os_enter_critical_section);
+        os_isr_priority_hook();
+    }
+#endif
+    __set_BASEPRI(OS_BASEPRI_VALUE);
+    // the new mask must be active before the next instruction
+    __ISB();
+#else
     __disable_irq();
+#endif
     os_controller.current_critical_sections++;
 }
 
@@ -449,6 +1342,10 @@ inline void os_enter_critical_section(void)    {
 inline void os_exit_critical_section(void)  {
     os_controller.current_critical_sections--;
     if (os_controller.current_critical_sections <= 0)   {
+#if OS_USE_BASEPRI
+        __set_BASEPRI(0);
+#else
         __enable_irq();
+#endif
     }
 }
@@ -9,16 +9,88 @@
 #include "br_os_isr.h"
 
 
+#define DEFERRED_ISR_TASK_ID    0xFD    // after IDLE_TASK_ID and TIMER_TASK_ID (br_os_core.c)
+
+// bottom half pending in the deferred interrupt queue
+typedef struct  {
+    LPC43XX_IRQn_Type   irq;
+    uint32_t            payload;
+    uint16_t            generation;     // isr_generation[irq] when it was queued
+    bool                masked;         // queued by an interrupt without top half
+} os_deferred_work;
+
+
 static void* user_isr_vector[N_IRQ];
 
+// deferred interrupts, registered with os_register_deferred_isr()
+static isr_top_half top_half_vector[N_IRQ];
+static isr_bottom_half bottom_half_vector[N_IRQ];
+
+static os_task deferred_isr_task_instance;
+static OS_TASK_STACK(deferred_isr_task_stack, OS_DEFERRED_ISR_STACK_SIZE);
+static bool deferred_isr_task_started = false;
+
+static os_queue deferred_queue;
+static OS_QUEUE_STORAGE(deferred_queue_storage, sizeof(os_deferred_work), OS_DEFERRED_ISR_QUEUE_LENGTH);
+
+// incremented by os_remove_isr(), so the work queued before removing an interrupt is
+// not passed to a handler registered afterwards on the same interrupt
+static uint16_t isr_generation[N_IRQ];
+
+// slots of the queue reserved for the deferred interrupts without top half: one for each
+// registered interrupt, and one for each removed interrupt whose work is still queued
+static uint8_t masked_irqs = 0;
+// work of interrupts without top half in the queue, it uses the reserved slots
+static uint8_t queued_masked_irqs = 0;
+// true while the work of a registered interrupt without top half is queued
+static bool masked_irq_queued[N_IRQ];
+
+// bottom halves lost because the queue was full
+static uint32_t deferred_isr_overruns = 0;
+
+// interrupts that fired without a registered handler
+static uint32_t spurious_irqs = 0;
+
+
+/*************************************************************************************************
+     *  @brief Verifica que una interrupcion se pueda registrar: que no este registrada y, con
+     *  OS_USE_BASEPRI, que su prioridad le permita usar el OS.
+     *
+     * Una interrupcion con la prioridad de reset (0) pasa a OS_MAX_SYSCALL_INTERRUPT_PRIORITY.
+     * caller es la funcion de registro, que se informa con el error.
+***************************************************************************************************/
+static bool os_can_register_isr(LPC43XX_IRQn_Type irq, void* caller)  {
+
+    if (user_isr_vector[irq] != NULL || bottom_half_vector[irq] != NULL)  {
+        return false;
+    }
+
+#if OS_USE_BASEPRI
+    // priority 0 is never masked by the OS, so an interrupt left at the reset priority is lowered
+    if (NVIC_GetPriority(irq) == 0) {
+        NVIC_SetPriority(irq, OS_MAX_SYSCALL_INTERRUPT_PRIORITY);
+    }
+    else if (NVIC_GetPriority(irq) < OS_MAX_SYSCALL_INTERRUPT_PRIORITY)    {
+        os_set_error(OS_ERROR_ISR_PRIORITY, caller);
+        return false;
+    }
+#endif
+
+    return true;
+}
+
 
 /*************************************************************************************************
      *  @brief Registra una interrupcion.
      *
+     * Con OS_USE_BASEPRI la prioridad de la interrupcion (NVIC_SetPriority) debe ser igual o menor
+     * que OS_MAX_SYSCALL_INTERRUPT_PRIORITY; si no se configuro (0, la de reset) se usa
+     * OS_MAX_SYSCALL_INTERRUPT_PRIORITY. Las interrupciones de mayor prioridad no pueden usar el
+     * OS y se instalan definiendo directamente su handler (ver OS_IRQ_<name>_EXTERNAL).
 ***************************************************************************************************/
 bool os_register_isr(LPC43XX_IRQn_Type irq, void* user_isr) {
 
-    if (user_isr_vector[irq] == NULL)   {
+    if (os_can_register_isr(irq, os_register_isr))   {
         user_isr_vector[irq] = user_isr;
         NVIC_ClearPendingIRQ(irq);
         NVIC_EnableIRQ(irq);
@@ -30,15 +102,15 @@ bool os_register_isr(LPC43XX_IRQn_Type irq, void* user_isr) {
 
 
 /*************************************************************************************************
-     *  @brief Elimina una interrupcion.
+     *  @brief Habilita una interrupcion asociada en compilacion con OS_STATIC_ISR(), con las
+     *  mismas verificaciones que os_register_isr().
      *
 ***************************************************************************************************/
-bool os_RemoverIRQ(LPC43XX_IRQn_Type irq)   {
+bool os_enable_static_isr(LPC43XX_IRQn_Type irq)    {
 
-    if (user_isr_vector[irq] != NULL)   {
-        user_isr_vector[irq] = NULL;
+    if (os_can_register_isr(irq, os_enable_static_isr))  {
         NVIC_ClearPendingIRQ(irq);
-        NVIC_DisableIRQ(irq);
+        NVIC_EnableIRQ(irq);
         return true;
     }
 
@@ -46,6 +118,213 @@ bool os_RemoverIRQ(LPC43XX_IRQn_Type irq)   {
 }
 
 
+/*************************************************************************************************
+     *  @brief Tarea que ejecuta las bottom halves de las interrupciones diferidas, en el orden en
+     *  que ocurrieron las interrupciones.
+     *
+***************************************************************************************************/
+static void os_deferred_isr_task(void* task_param)  {
+    os_deferred_work work;
+    isr_bottom_half bottom_half;
+    bool registered;
+
+    while(1)    {
+        os_queue_receive(&deferred_queue, &work, NO_TIMEOUT);
+
+        os_enter_critical_section();
+
+        // the interrupt may have been removed (and registered again) while its bottom half was pending
+        registered = (work.generation == isr_generation[work.irq]);
+
+        if (work.masked)    {
+            queued_masked_irqs--;
+
+            if (registered) {
+                masked_irq_queued[work.irq] = false;
+            }
+            else    {
+                // os_remove_isr() left the slot reserved until its work left the queue
+                masked_irqs--;
+            }
+        }
+
+        bottom_half = registered ? bottom_half_vector[work.irq] : NULL;
+
+        os_exit_critical_section();
+
+        if (bottom_half == NULL)    {
+            continue;
+        }
+
+        bottom_half(work.irq, work.payload);
+
+        // without top half the interrupt stays masked until the bottom half acknowledges the peripheral
+        if (work.masked)    {
+            os_enter_critical_section();
+            if (work.generation == isr_generation[work.irq])    {
+                NVIC_ClearPendingIRQ(work.irq);
+                NVIC_EnableIRQ(work.irq);
+            }
+            os_exit_critical_section();
+        }
+    }
+}
+
+
+/*************************************************************************************************
+     *  @brief Registra una interrupcion diferida. La interrupcion solo ejecuta top_half, que
+     *  reconoce la interrupcion en el periferico y devuelve un dato (payload), y el resto del
+     *  trabajo lo hace bottom_half desde una tarea de alta prioridad, con acceso a todo el OS.
+     *
+     * top_half puede ser NULL: en ese caso la interrupcion queda deshabilitada en el NVIC hasta
+     * que se ejecute bottom_half (payload = 0). La primera interrupcion diferida crea la tarea.
+     * Retorna false si la interrupcion ya estaba registrada, si bottom_half es NULL o si no queda
+     * lugar en la cola para otra interrupcion sin top half.
+***************************************************************************************************/
+bool os_register_deferred_isr(LPC43XX_IRQn_Type irq, isr_top_half top_half, isr_bottom_half bottom_half)  {
+
+    // at least one slot must remain for the interrupts with top half
+    if (bottom_half == NULL || (top_half == NULL && masked_irqs >= OS_DEFERRED_ISR_QUEUE_LENGTH - 1))   {
+        return false;
+    }
+
+    if (!os_can_register_isr(irq, os_register_deferred_isr))  {
+        return false;
+    }
+
+    if (!deferred_isr_task_started) {
+        os_queue_init(&deferred_queue, deferred_queue_storage, sizeof(os_deferred_work), OS_DEFERRED_ISR_QUEUE_LENGTH);
+        os_init_kernel_task(os_deferred_isr_task, &deferred_isr_task_instance, DEFERRED_ISR_TASK_ID,
+                            OS_DEFERRED_ISR_TASK_PRIORITY, deferred_isr_task_stack, sizeof(deferred_isr_task_stack));
+        deferred_isr_task_started = true;
+    }
+
+    os_enter_critical_section();
+
+    if (top_half == NULL)   {
+        masked_irqs++;
+    }
+    top_half_vector[irq] = top_half;
+    bottom_half_vector[irq] = bottom_half;
+
+    os_exit_critical_section();
+
+    NVIC_ClearPendingIRQ(irq);
+    NVIC_EnableIRQ(irq);
+
+    return true;
+}
+
+
+/*************************************************************************************************
+     *  @brief Elimina una interrupcion. Las bottom halves que quedaron pendientes en la cola se
+     *  descartan.
+     *
+***************************************************************************************************/
+bool os_remove_isr(LPC43XX_IRQn_Type irq)   {
+
+    bool removed = false;
+
+    os_enter_critical_section();
+
+    if (user_isr_vector[irq] != NULL || bottom_half_vector[irq] != NULL)    {
+        NVIC_DisableIRQ(irq);
+        NVIC_ClearPendingIRQ(irq);
+
+        // if its work is still queued, the deferred interrupt task releases the slot when it dequeues it
+        if (bottom_half_vector[irq] != NULL && top_half_vector[irq] == NULL && !masked_irq_queued[irq])    {
+            masked_irqs--;
+        }
+        masked_irq_queued[irq] = false;
+        isr_generation[irq]++;
+
+        user_isr_vector[irq] = NULL;
+        top_half_vector[irq] = NULL;
+        bottom_half_vector[irq] = NULL;
+        removed = true;
+    }
+
+    os_exit_critical_section();
+
+    return removed;
+}
+
+
+/*************************************************************************************************
+     *  @brief Devuelve la tarea de las interrupciones diferidas (por ejemplo para medir su
+     *  stack), o NULL si no se registro ninguna.
+     *
+***************************************************************************************************/
+os_task* os_get_deferred_isr_task(void) {
+    return deferred_isr_task_started ? &deferred_isr_task_instance : NULL;
+}
+
+
+/*************************************************************************************************
+     *  @brief Devuelve la cantidad de bottom halves descartadas porque la cola estaba llena.
+     *
+***************************************************************************************************/
+uint32_t os_get_deferred_isr_overruns(void) {
+    return deferred_isr_overruns;
+}
+
+
+/*************************************************************************************************
+     *  @brief Devuelve la cantidad de interrupciones que ocurrieron sin un handler registrado.
+     *  Cada una queda deshabilitada hasta que se la registre.
+     *
+***************************************************************************************************/
+uint32_t os_get_spurious_irqs(void) {
+    return spurious_irqs;
+}
+
+
+/*************************************************************************************************
+     *  @brief Parte de una interrupcion diferida que se ejecuta dentro de la interrupcion:
+     *  ejecuta la top half (o deshabilita la interrupcion si no tiene) y encola la bottom half.
+     *
+***************************************************************************************************/
+static void os_defer_isr(LPC43XX_IRQn_Type irq)  {
+    os_deferred_work work;
+    isr_top_half top_half = top_half_vector[irq];
+    bool higher_priority_task_woken = false;
+
+    work.irq = irq;
+    work.generation = isr_generation[irq];
+    work.masked = (top_half == NULL);
+
+    os_enter_critical_section();
+
+    if (work.masked)    {
+        // the slot reserved for this interrupt is free, it cannot fire again until the bottom half runs
+        work.payload = 0;
+
+        if (os_queue_send_from_isr(&deferred_queue, &work, &higher_priority_task_woken) == OS_OK)   {
+            NVIC_DisableIRQ(irq);
+            masked_irq_queued[irq] = true;
+            queued_masked_irqs++;
+        }
+        else    {
+            // the interrupt is left enabled so it is not lost
+            deferred_isr_overruns++;
+        }
+    }
+    else    {
+        work.payload = top_half();
+
+        // only the reserved slots not used yet are unavailable, the used ones are counted in current_elements
+        if (deferred_queue.current_elements >= OS_DEFERRED_ISR_QUEUE_LENGTH - (masked_irqs - queued_masked_irqs) ||
+            os_queue_send_from_isr(&deferred_queue, &work, &higher_priority_task_woken) != OS_OK)  {
+            deferred_isr_overruns++;
+        }
+    }
+
+    os_exit_critical_section();
+
+    os_yield_from_isr(higher_priority_task_woken);
+}
+
+
 
 
 /*************************************************************************************************
@@ -56,80 +335,184 @@ bool os_RemoverIRQ(LPC43XX_IRQn_Type irq)   {
 static void os_isr_handler(LPC43XX_IRQn_Type IRQn)  {
     void (*user_isr)(void); // function pointer to the ISR
 
-    // get the OS state, to restore after calling the ISR
-    os_state previous_os_state = os_get_global_state();
-
-    // set the OS state to indicate that it is inside an ISR
-    os_set_global_state(OS_STATE_ISR);
+    // the OS state is OS_STATE_ISR until the outermost interrupt exits
+    os_isr_enter();
 
-    // call the user defined ISR
+    // call the user defined ISR, or only its top half if it is deferred
     user_isr = user_isr_vector[IRQn];
-    user_isr();
-
-    // restore the OS state
-    os_set_global_state(previous_os_state);
+    if (user_isr != NULL)   {
+        user_isr();
+    }
+    else if (bottom_half_vector[IRQn] != NULL)  {
+        os_defer_isr(IRQn);
+    }
+    else    {
+        // not registered (or removed while it was pending): it is disabled so it does not fire again
+        NVIC_DisableIRQ(IRQn);
+        spurious_irqs++;
+    }
 
     // clear the corresponding interrupt flag
     NVIC_ClearPendingIRQ(IRQn);
 
-    // immediatelly call the scheduler if needed (because the
-    // interrupt released a resource/event)
-    if (os_get_scheduler_from_isr() == true)    {
-
-        os_set_scheduler_from_isr(false);
-        os_cpu_yield();
-    }
+    // call the scheduler if this or a nested interrupt released a resource/event,
+    // only once when the outermost interrupt exits
+    os_isr_exit();
 }
 
 /*==================[interrupt service routines]=============================*/
 
+// an interrupt that does not use the OS, or that is bound with OS_STATIC_ISR(), defines its own
+// handler: build with OS_IRQ_<name>_EXTERNAL=1 (for example OS_IRQ_TIMER1_EXTERNAL for
+// TIMER1_IRQHandler) to leave this one out
+
+#if !OS_IRQ_DAC_EXTERNAL
 void DAC_IRQHandler(void)           { os_isr_handler( DAC_IRQn         ); }
+#endif
+#if !OS_IRQ_M0APP_EXTERNAL
 void M0APP_IRQHandler(void)         { os_isr_handler( M0APP_IRQn       ); }
+#endif
+#if !OS_IRQ_DMA_EXTERNAL
 void DMA_IRQHandler(void)           { os_isr_handler( DMA_IRQn         ); }
+#endif
+#if !OS_IRQ_FLASH_EEPROM_EXTERNAL
 void FLASH_EEPROM_IRQHandler(void)  { os_isr_handler( RESERVED1_IRQn   ); }
+#endif
+#if !OS_IRQ_ETH_EXTERNAL
 void ETH_IRQHandler(void)           { os_isr_handler( ETHERNET_IRQn    ); }
+#endif
+#if !OS_IRQ_SDIO_EXTERNAL
 void SDIO_IRQHandler(void)          { os_isr_handler( SDIO_IRQn        ); }
+#endif
+#if !OS_IRQ_LCD_EXTERNAL
 void LCD_IRQHandler(void)           { os_isr_handler( LCD_IRQn         ); }
+#endif
+#if !OS_IRQ_USB0_EXTERNAL
 void USB0_IRQHandler(void)          { os_isr_handler( USB0_IRQn        ); }
+#endif
+#if !OS_IRQ_USB1_EXTERNAL
 void USB1_IRQHandler(void)          { os_isr_handler( USB1_IRQn        ); }
+#endif
+#if !OS_IRQ_SCT_EXTERNAL
 void SCT_IRQHandler(void)           { os_isr_handler( SCT_IRQn         ); }
+#endif
+#if !OS_IRQ_RIT_EXTERNAL
 void RIT_IRQHandler(void)           { os_isr_handler( RITIMER_IRQn     ); }
+#endif
+#if !OS_IRQ_TIMER0_EXTERNAL
 void TIMER0_IRQHandler(void)        { os_isr_handler( TIMER0_IRQn      ); }
+#endif
+#if !OS_IRQ_TIMER1_EXTERNAL
 void TIMER1_IRQHandler(void)        { os_isr_handler( TIMER1_IRQn      ); }
+#endif
+#if !OS_IRQ_TIMER2_EXTERNAL
 void TIMER2_IRQHandler(void)        { os_isr_handler( TIMER2_IRQn      ); }
+#endif
+#if !OS_IRQ_TIMER3_EXTERNAL
 void TIMER3_IRQHandler(void)        { os_isr_handler( TIMER3_IRQn      ); }
+#endif
+#if !OS_IRQ_MCPWM_EXTERNAL
 void MCPWM_IRQHandler(void)         { os_isr_handler( MCPWM_IRQn       ); }
+#endif
+#if !OS_IRQ_ADC0_EXTERNAL
 void ADC0_IRQHandler(void)          { os_isr_handler( ADC0_IRQn        ); }
+#endif
+#if !OS_IRQ_I2C0_EXTERNAL
 void I2C0_IRQHandler(void)          { os_isr_handler( I2C0_IRQn        ); }
+#endif
+#if !OS_IRQ_SPI_EXTERNAL
 void SPI_IRQHandler(void)           { os_isr_handler( I2C1_IRQn        ); }
+#endif
+#if !OS_IRQ_I2C1_EXTERNAL
 void I2C1_IRQHandler(void)          { os_isr_handler( SPI_INT_IRQn     ); }
+#endif
+#if !OS_IRQ_ADC1_EXTERNAL
 void ADC1_IRQHandler(void)          { os_isr_handler( ADC1_IRQn        ); }
+#endif
+#if !OS_IRQ_SSP0_EXTERNAL
 void SSP0_IRQHandler(void)          { os_isr_handler( SSP0_IRQn        ); }
+#endif
+#if !OS_IRQ_SSP1_EXTERNAL
 void SSP1_IRQHandler(void)          { os_isr_handler( SSP1_IRQn        ); }
+#endif
+#if !OS_IRQ_UART0_EXTERNAL
 void UART0_IRQHandler(void)         { os_isr_handler( USART0_IRQn      ); }
+#endif
+#if !OS_IRQ_UART1_EXTERNAL
 void UART1_IRQHandler(void)         { os_isr_handler( UART1_IRQn       ); }
+#endif
+#if !OS_IRQ_UART2_EXTERNAL
 void UART2_IRQHandler(void)         { os_isr_handler( USART2_IRQn      ); }
+#endif
+#if !OS_IRQ_UART3_EXTERNAL
 void UART3_IRQHandler(void)         { os_isr_handler( USART3_IRQn      ); }
+#endif
+#if !OS_IRQ_I2S0_EXTERNAL
 void I2S0_IRQHandler(void)          { os_isr_handler( I2S0_IRQn        ); }
+#endif
+#if !OS_IRQ_I2S1_EXTERNAL
 void I2S1_IRQHandler(void)          { os_isr_handler( I2S1_IRQn        ); }
+#endif
+#if !OS_IRQ_SPIFI_EXTERNAL
 void SPIFI_IRQHandler(void)         { os_isr_handler( RESERVED4_IRQn   ); }
+#endif
+#if !OS_IRQ_SGPIO_EXTERNAL
 void SGPIO_IRQHandler(void)         { os_isr_handler( SGPIO_INT_IRQn   ); }
+#endif
+#if !OS_IRQ_GPIO0_EXTERNAL
 void GPIO0_IRQHandler(void)         { os_isr_handler( PIN_INT0_IRQn    ); }
+#endif
+#if !OS_IRQ_GPIO1_EXTERNAL
 void GPIO1_IRQHandler(void)         { os_isr_handler( PIN_INT1_IRQn    ); }
+#endif
+#if !OS_IRQ_GPIO2_EXTERNAL
 void GPIO2_IRQHandler(void)         { os_isr_handler( PIN_INT2_IRQn    ); }
+#endif
+#if !OS_IRQ_GPIO3_EXTERNAL
 void GPIO3_IRQHandler(void)         { os_isr_handler( PIN_INT3_IRQn    ); }
+#endif
+#if !OS_IRQ_GPIO4_EXTERNAL
 void GPIO4_IRQHandler(void)         { os_isr_handler( PIN_INT4_IRQn    ); }
+#endif
+#if !OS_IRQ_GPIO5_EXTERNAL
 void GPIO5_IRQHandler(void)         { os_isr_handler( PIN_INT5_IRQn    ); }
+#endif
+#if !OS_IRQ_GPIO6_EXTERNAL
 void GPIO6_IRQHandler(void)         { os_isr_handler( PIN_INT6_IRQn    ); }
+#endif
+#if !OS_IRQ_GPIO7_EXTERNAL
 void GPIO7_IRQHandler(void)         { os_isr_handler( PIN_INT7_IRQn    ); }
+#endif
+#if !OS_IRQ_GINT0_EXTERNAL
 void GINT0_IRQHandler(void)         { os_isr_handler( GINT0_IRQn       ); }
+#endif
+#if !OS_IRQ_GINT1_EXTERNAL
 void GINT1_IRQHandler(void)         { os_isr_handler( GINT1_IRQn       ); }
+#endif
+#if !OS_IRQ_EVRT_EXTERNAL
 void EVRT_IRQHandler(void)          { os_isr_handler( EVENTROUTER_IRQn ); }
+#endif
+#if !OS_IRQ_CAN1_EXTERNAL
 void CAN1_IRQHandler(void)          { os_isr_handler( C_CAN1_IRQn      ); }
+#endif
+#if !OS_IRQ_ADCHS_EXTERNAL
 void ADCHS_IRQHandler(void)         { os_isr_handler( ADCHS_IRQn       ); }
+#endif
+#if !OS_IRQ_ATIMER_EXTERNAL
 void ATIMER_IRQHandler(void)        { os_isr_handler( ATIMER_IRQn      ); }
+#endif
+#if !OS_IRQ_RTC_EXTERNAL
 void RTC_IRQHandler(void)           { os_isr_handler( RTC_IRQn         ); }
+#endif
+#if !OS_IRQ_WDT_EXTERNAL
 void WDT_IRQHandler(void)           { os_isr_handler( WWDT_IRQn        ); }
+#endif
+#if !OS_IRQ_M0SUB_EXTERNAL
 void M0SUB_IRQHandler(void)         { os_isr_handler( M0SUB_IRQn       ); }
+#endif
+#if !OS_IRQ_CAN0_EXTERNAL
 void CAN0_IRQHandler(void)          { os_isr_handler( C_CAN0_IRQn      ); }
+#endif
+#if !OS_IRQ_QEI_EXTERNAL
 void QEI_IRQHandler(void)           { os_isr_handler( QEI_IRQn         ); }
+#endif
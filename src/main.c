@@ -23,6 +23,19 @@
 #define LED_VERDE       LED3
 #define LED_AZUL        LEDB
 
+#define UART_CHUNK_SIZE 32      // bytes copied from the stream buffer by each read
+
+// bits del grupo de eventos de las teclas
+#define EV_TEC1_FALLING     (1 << 0)
+#define EV_TEC1_RISING      (1 << 1)
+#define EV_TEC2_FALLING     (1 << 2)
+#define EV_TEC2_RISING      (1 << 3)
+#define EV_RESET_TEC1       (1 << 4)
+#define EV_RESET_TEC2       (1 << 5)
+
+#define EV_TEC1_EDGES       (EV_TEC1_FALLING | EV_TEC1_RISING)
+#define EV_TEC2_EDGES       (EV_TEC2_FALLING | EV_TEC2_RISING)
+
 
 /*==================[internal data definition]===============================*/
 typedef struct  {
@@ -40,18 +53,26 @@ os_task led_task;
 // tarea para manejar el envio de datos por UART
 os_task uart_task;
 
-// semaforos para indicar desde las correspondientes rutinas de interrupcion,
-// que un determinado flanco ha ocurrido
-os_semaphore sem_tec1_falling, sem_tec1_rising;
-os_semaphore sem_tec2_falling, sem_tec2_rising;
-// semaforos para indicar que las tareas de tecla 1 y 2 pueden comenzar nuevamente
+// stacks de las tareas, dimensionados segun lo que usa cada una
+OS_TASK_STACK(tec1_stack, 192);
+OS_TASK_STACK(tec2_stack, 192);
+OS_TASK_STACK(led_stack, 384);
+OS_TASK_STACK(uart_stack, 224);    // + UART_CHUNK_SIZE
+
+// grupo de eventos para indicar desde las correspondientes rutinas de interrupcion que un
+// determinado flanco ha ocurrido, y que las tareas de tecla 1 y 2 pueden comenzar nuevamente
 // (debido a que ya han llegado ambos flancos de ambas teclas)
-os_semaphore sem_reset_tec1, sem_reset_tec2;
+os_event_group tec_events;
 
 // colas para enviar la informacion de las teclas a la tarea que manejo los LEDs
 os_queue tec1_time, tec2_time;
-// cola para enviar bytes por UART
-os_queue uart_queue;
+// stream buffer para enviar bytes por UART
+os_stream_buffer uart_stream;
+
+// memoria de las colas (la cantidad de elementos debe ser potencia de 2)
+OS_QUEUE_STORAGE(tec1_time_storage, sizeof(tecla_info), 4);
+OS_QUEUE_STORAGE(tec2_time_storage, sizeof(tecla_info), 4);
+OS_STREAM_BUFFER_STORAGE(uart_stream_storage, 128);
 
 tecla_info info_tec1;
 tecla_info info_tec2;
@@ -115,33 +136,31 @@ static void initHardware(void)  {
 /*************************************************************************************************
      *  @brief Tarea para registar los tiempos en los que se presiona y libera la tecla 1 (TEC1).
      * 
-     * Notar que la tarea se queda esperando por el semaforo sem_reset_tec1, el cual es liberado
-     * al finalizar la tarea encargada de encender los LEDs (led_task).
-     * Por lo tanto, para un correcto funcionamieto se debe esperar a que el LED se apague para 
-     * volver a presionar/soltar los botones (ya que sino se produce un desfasaje entre que la
-     * interrupcion libera el semaforo y la tarea registra el tiempo). Caso contrario, la tarea
-     * led_task indicara que se realizo una secuencia invalida.
+     * Los tiempos de los flancos los registran las interrupciones, y la tarea espera ambos flancos
+     * con un solo bloqueo. Luego se queda esperando por el evento EV_RESET_TEC1, el cual es
+     * seteado al finalizar la tarea encargada de encender los LEDs (led_task).
+     * Por lo tanto, para un correcto funcionamieto se debe esperar a que el LED se apague para
+     * volver a presionar/soltar los botones. Los flancos ocurridos mientras tanto se descartan.
      *
 ***************************************************************************************************/
 void tec1_method(void* task_param) {
 
     while(1)    {
 
-        // esperar el flanco de bajada (tecla pulsada)
-        os_semaphore_take(&sem_tec1_falling, NO_TIMEOUT);
-        info_tec1.tiempo_flanco_desc = os_get_current_time();
-
-        // esperar el flanco de subida (tecla pulsada)
-        os_semaphore_take(&sem_tec1_rising, NO_TIMEOUT);
-        info_tec1.tiempo_flanco_asc = os_get_current_time();
+        // esperar los flancos de bajada y de subida (tecla pulsada y liberada)
+        os_event_group_wait(&tec_events, EV_TEC1_EDGES, OS_EVENT_WAIT_ALL | OS_EVENT_CLEAR_ON_EXIT, NO_TIMEOUT, NULL);
 
         // enviar a la cola la informacion de la tecla
-        os_queue_send(&tec1_time, &info_tec1);
+        os_queue_send(&tec1_time, &info_tec1, NO_TIMEOUT);
 
         // esperar hasta que se hayan procesado los tiempos de ambas tareas
-        os_semaphore_take(&sem_reset_tec1, NO_TIMEOUT);
-        // resetear tiempos de la tecla
+        os_event_group_wait(&tec_events, EV_RESET_TEC1, OS_EVENT_CLEAR_ON_EXIT, NO_TIMEOUT, NULL);
+        // resetear tiempos de la tecla y descartar los flancos ocurridos mientras tanto, sin que
+        // una interrupcion pueda registrar un flanco entre ambos pasos
+        os_enter_critical_section();
         init_tecla_info(&info_tec1, 1);
+        os_event_group_clear(&tec_events, EV_TEC1_EDGES);
+        os_exit_critical_section();
 
     }
 }
@@ -157,21 +176,20 @@ void tec2_method(void* task_param) {
 
     while(1)    {
 
-        // esperar el flanco de bajada (tecla pulsada)
-        os_semaphore_take(&sem_tec2_falling, NO_TIMEOUT);
-        info_tec2.tiempo_flanco_desc = os_get_current_time();
-
-        // esperar el flanco de subida (tecla pulsada)
-        os_semaphore_take(&sem_tec2_rising, NO_TIMEOUT);
-        info_tec2.tiempo_flanco_asc = os_get_current_time();
+        // esperar los flancos de bajada y de subida (tecla pulsada y liberada)
+        os_event_group_wait(&tec_events, EV_TEC2_EDGES, OS_EVENT_WAIT_ALL | OS_EVENT_CLEAR_ON_EXIT, NO_TIMEOUT, NULL);
 
         // enviar a la cola la informacion de la tecla
-        os_queue_send(&tec2_time, &info_tec2);
+        os_queue_send(&tec2_time, &info_tec2, NO_TIMEOUT);
 
         // esperar hasta que se hayan procesado los tiempos de ambas tareas
-        os_semaphore_take(&sem_reset_tec2, NO_TIMEOUT);
-        // resetear tiempos de la tecla
+        os_event_group_wait(&tec_events, EV_RESET_TEC2, OS_EVENT_CLEAR_ON_EXIT, NO_TIMEOUT, NULL);
+        // resetear tiempos de la tecla y descartar los flancos ocurridos mientras tanto, sin que
+        // una interrupcion pueda registrar un flanco entre ambos pasos
+        os_enter_critical_section();
         init_tecla_info(&info_tec2, 2);
+        os_event_group_clear(&tec_events, EV_TEC2_EDGES);
+        os_exit_critical_section();
 
     }
 }
@@ -195,8 +213,8 @@ void turn_led(void* task_param) {
         memset(msg, 0, sizeof(char) * 50);
         invalid_sequence = false;
 
-        os_queue_receive(&tec1_time, &tecla_1);
-        os_queue_receive(&tec2_time, &tecla_2);
+        os_queue_receive(&tec1_time, &tecla_1, NO_TIMEOUT);
+        os_queue_receive(&tec2_time, &tecla_2, NO_TIMEOUT);
 
         if (tecla_1.tiempo_flanco_desc < tecla_2.tiempo_flanco_desc &&
             tecla_1.tiempo_flanco_asc < tecla_2.tiempo_flanco_asc)  {
@@ -230,6 +248,7 @@ void turn_led(void* task_param) {
             invalid_sequence = true;
             strcpy(msg, "Secuencia invalida.\n\r");
             send_uart_msg(msg, 50);
+            os_stream_buffer_flush(&uart_stream);
         }
 
         if (!invalid_sequence)  {
@@ -262,14 +281,16 @@ void turn_led(void* task_param) {
             strcpy(msg, " ms\n\r");
             send_uart_msg(msg, 50);
 
+            // the end of the report is sent even if it does not fill a chunk
+            os_stream_buffer_flush(&uart_stream);
+
 
             gpioWrite(led, true);
             os_delay(tiempo_encendido);
             gpioWrite(led, false);
         }
 
-        os_semaphore_give(&sem_reset_tec1);
-        os_semaphore_give(&sem_reset_tec2);
+        os_event_group_set(&tec_events, EV_RESET_TEC1 | EV_RESET_TEC2);
     }
 }
 
@@ -279,11 +300,16 @@ void turn_led(void* task_param) {
      *
 ***************************************************************************************************/
 void send_uart(void* task_param)    {
-    char aux;
+    char buffer[UART_CHUNK_SIZE];
+    uint16_t length;
 
     while(1)    {
-        os_queue_receive(&uart_queue, &aux);
-        uartWriteByte(UART_USB, aux);
+        // the task wakes up once a whole chunk is available, or when turn_led flushes the end
+        // of a report
+        length = os_stream_buffer_read(&uart_stream, buffer, sizeof(buffer), NO_TIMEOUT);
+        for (uint16_t i=0; i<length; i++)   {
+            uartWriteByte(UART_USB, buffer[i]);
+        }
     }
 }
 
@@ -293,25 +319,26 @@ int main(void)  {
 
     initHardware();
 
-    os_init_task(tec1_method, &tec1_task, NULL, 0);
-    os_init_task(tec2_method, &tec2_task, NULL, 0);
-    os_init_task(turn_led, &led_task, NULL, 0);
-    os_init_task(send_uart, &uart_task, NULL, 3);
+    os_init_task(tec1_method, &tec1_task, NULL, 0, tec1_stack, sizeof(tec1_stack));
+    os_init_task(tec2_method, &tec2_task, NULL, 0, tec2_stack, sizeof(tec2_stack));
+    os_init_task(turn_led, &led_task, NULL, 0, led_stack, sizeof(led_stack));
+    os_init_task(send_uart, &uart_task, NULL, 3, uart_stack, sizeof(uart_stack));
 
-    os_semaphore_init(&sem_tec1_falling);
-    os_semaphore_init(&sem_tec1_rising);
-    os_semaphore_init(&sem_tec2_falling);
-    os_semaphore_init(&sem_tec2_rising);
-    os_semaphore_init(&sem_reset_tec1);
-    os_semaphore_init(&sem_reset_tec2);
+    os_event_group_init(&tec_events);
 
-    os_queue_init(&tec1_time, sizeof(tecla_info));
-    os_queue_init(&tec2_time, sizeof(tecla_info));
-    os_queue_init(&uart_queue, sizeof(char));
+    os_queue_init(&tec1_time, tec1_time_storage, sizeof(tecla_info), 4);
+    os_queue_init(&tec2_time, tec2_time_storage, sizeof(tecla_info), 4);
+    os_stream_buffer_init(&uart_stream, uart_stream_storage, sizeof(uart_stream_storage), UART_CHUNK_SIZE);
 
     init_tecla_info(&info_tec1, 1);
     init_tecla_info(&info_tec2, 2);
 
+    // interrupts that use the OS must not be above OS_MAX_SYSCALL_INTERRUPT_PRIORITY
+    NVIC_SetPriority(PIN_INT0_IRQn, OS_MAX_SYSCALL_INTERRUPT_PRIORITY);
+    NVIC_SetPriority(PIN_INT1_IRQn, OS_MAX_SYSCALL_INTERRUPT_PRIORITY);
+    NVIC_SetPriority(PIN_INT2_IRQn, OS_MAX_SYSCALL_INTERRUPT_PRIORITY);
+    NVIC_SetPriority(PIN_INT3_IRQn, OS_MAX_SYSCALL_INTERRUPT_PRIORITY);
+
     os_register_isr(PIN_INT0_IRQn, tec1_down_isr);
     os_register_isr(PIN_INT1_IRQn, tec1_up_isr);
     os_register_isr(PIN_INT2_IRQn, tec2_down_isr);
@@ -326,26 +353,46 @@ int main(void)  {
 
 
 void tec1_down_isr (void) {
-    os_semaphore_give(&sem_tec1_falling);
+    bool higher_priority_task_woken = false;
+
+    info_tec1.tiempo_flanco_desc = os_get_current_time();
+    os_event_group_set_from_isr(&tec_events, EV_TEC1_FALLING, &higher_priority_task_woken);
     Chip_PININT_ClearIntStatus( LPC_GPIO_PIN_INT, PININTCH( 0 ) );
+
+    os_yield_from_isr(higher_priority_task_woken);
 }
 
 
 void tec1_up_isr(void)  {
-    os_semaphore_give(&sem_tec1_rising);
+    bool higher_priority_task_woken = false;
+
+    info_tec1.tiempo_flanco_asc = os_get_current_time();
+    os_event_group_set_from_isr(&tec_events, EV_TEC1_RISING, &higher_priority_task_woken);
     Chip_PININT_ClearIntStatus( LPC_GPIO_PIN_INT, PININTCH( 1 ) );
+
+    os_yield_from_isr(higher_priority_task_woken);
 }
 
 
 void tec2_down_isr (void) {
-    os_semaphore_give(&sem_tec2_falling);
+    bool higher_priority_task_woken = false;
+
+    info_tec2.tiempo_flanco_desc = os_get_current_time();
+    os_event_group_set_from_isr(&tec_events, EV_TEC2_FALLING, &higher_priority_task_woken);
     Chip_PININT_ClearIntStatus( LPC_GPIO_PIN_INT, PININTCH( 2 ) );
+
+    os_yield_from_isr(higher_priority_task_woken);
 }
 
 
 void tec2_up_isr(void)  {
-    os_semaphore_give(&sem_tec2_rising);
+    bool higher_priority_task_woken = false;
+
+    info_tec2.tiempo_flanco_asc = os_get_current_time();
+    os_event_group_set_from_isr(&tec_events, EV_TEC2_RISING, &higher_priority_task_woken);
     Chip_PININT_ClearIntStatus( LPC_GPIO_PIN_INT, PININTCH( 3 ) );
+
+    os_yield_from_isr(higher_priority_task_woken);
 }
 
 
@@ -384,11 +431,12 @@ char* itoa(int i, char b[]) {
 }
 
 void send_uart_msg(char msg[], uint8_t max_len)    {
-    uint8_t char_index = 0;
-    while (msg[char_index] != NULL && char_index < max_len) {
-        os_queue_send(&uart_queue, (msg + char_index));
-        char_index++;
+    uint8_t length = 0;
+    while (msg[length] != '\0' && length < max_len) {
+        length++;
     }
+    // the whole message is copied with a single write
+    os_stream_buffer_write(&uart_stream, msg, length, NO_TIMEOUT);
 }
 
 /*==================[end of file]============================================*/